@@ -0,0 +1,59 @@
+#include "AllocationCounter.h"
+
+#ifdef TESTING
+
+#include <cstdlib>
+#include <new>
+
+static thread_local uint64_t threadAllocations = 0;
+
+uint64_t GetThreadAllocations()
+{
+	return threadAllocations;
+}
+
+void* operator new(size_t size)
+{
+	threadAllocations++;
+
+	void* memory = std::malloc(size == 0 ? 1 : size);
+	if (memory == nullptr)
+	{
+		throw std::bad_alloc();
+	}
+	return memory;
+}
+
+void* operator new[](size_t size)
+{
+	return operator new(size);
+}
+
+void operator delete(void* memory) noexcept
+{
+	std::free(memory);
+}
+
+void operator delete[](void* memory) noexcept
+{
+	std::free(memory);
+}
+
+void operator delete(void* memory, size_t) noexcept
+{
+	std::free(memory);
+}
+
+void operator delete[](void* memory, size_t) noexcept
+{
+	std::free(memory);
+}
+
+#else
+
+uint64_t GetThreadAllocations()
+{
+	return 0;
+}
+
+#endif
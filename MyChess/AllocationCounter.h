@@ -0,0 +1,25 @@
+#pragma once
+
+#include <cstdint>
+#include <cassert>
+
+// Number of heap allocations made by the calling thread. TESTING builds replace the global operator new to count them,
+// so the search can check that its own bookkeeping stays off the heap. Other builds always return 0
+uint64_t GetThreadAllocations();
+
+// Asserts in TESTING builds that the calling thread makes no heap allocations from construction to destruction. A
+// search node opens one, so any allocation in the node or the nodes below it fails the assert of the node that made it
+class NoAllocationScope
+{
+public:
+#ifdef TESTING
+	NoAllocationScope() : allocations(GetThreadAllocations()) {}
+	~NoAllocationScope() { assert(GetThreadAllocations() == allocations); }
+
+private:
+	uint64_t allocations;
+#else
+	// user provided, so other builds don't warn that the scope is never used
+	NoAllocationScope() {}
+#endif
+};
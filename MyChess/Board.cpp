@@ -9,16 +9,35 @@
 #endif
 
 #include "EvalBoard.h"
+#include "SearchWorker.h"
 
 Board::Board()
 {
-	VAO, EBO, VBO = 0;
+	VAO = 0;
+	EBO = 0;
+	VBO = 0;
+	piecesTextureId = 0;
+	evalBoard = nullptr;
+	compMoveWorker = nullptr;
 	bInMainMenu = true;
 	bInGame = false;
 	bTesting = false;
 
 	bestMoveStart = -1;
 	bestMoveEnd = -1;
+
+	// sized for the most any position needs up front, so that generating moves never has to grow them
+	foundMoves.reserve(32);
+	for (int i = 0; i < 64; i++)
+	{
+		attackMapWhite[i].reserve(32);
+		attackMapBlack[i].reserve(32);
+		validCheckMoves[i].reserve(32);
+	}
+	checkingPiecesWhite.reserve(16);
+	checkingPiecesBlack.reserve(16);
+	pinnedPiecesWhite.reserve(8);
+	pinnedPiecesBlack.reserve(8);
 }
 
 Board::~Board()
@@ -47,6 +66,15 @@ Board::~Board()
 	}
 	promotionPieces.clear();
 
+	if (compMoveWorker)
+	{
+		if (evalBoard)
+		{
+			evalBoard->StopEval();
+		}
+		delete compMoveWorker;
+	}
+
 	if (evalBoard)
 	{
 		delete evalBoard;
@@ -82,6 +110,18 @@ void Board::Init(unsigned int windowWidth, unsigned int windowHeight, GLFWwindow
 		printf("evalBoard is null!\n");
 	}
 	evalBoard->Init(this, soundEngine);
+	evalBoard->SetThreadCount(SEARCH_THREADS);
+	evalBoard->SetMultiPV(MULTI_PV);
+	if (USE_NNUE && evalBoard->LoadNetwork(NETWORK_FILE))
+	{
+		evalBoard->SetEvalMode(EvalBoard::EvalMode::NNUE);
+	}
+	if (USE_EVAL_FILE)
+	{
+		evalBoard->LoadEvalParameters(EVAL_FILE);
+	}
+
+	compMoveWorker = new SearchWorker();
 
 	SetBoardCoords();
 	PrepEdges();
@@ -589,7 +629,7 @@ void Board::PlayBlackCallback()
 	bInMainMenu = false;
 	bInGame = true;
 	SetupGame(false);
-	PlayCompMove();
+	compMoveWorker->Run([this] { this->PlayCompMove(); });
 }
 
 void Board::PlayMultiplayerCallback()
@@ -772,13 +812,13 @@ bool Board::CheckLegalMove(int startTile, int endTile)
 	return TileInContainer(endTile, currentTurn == PieceTeam::WHITE ? attackMapWhite[startTile] : attackMapBlack[startTile]);
 }
 
-void Board::CalcSlidingMovesOneDir(int startTile, int dir, int min, int max, int kingPos, bool& foundKing, std::vector<int>& checkLOS, std::vector<int>& attackingTiles)
+void Board::CalcSlidingMovesOneDir(int startTile, int dir, int min, int max, int kingPos, bool& foundKing, TileList& checkLOS, std::vector<int>& attackingTiles)
 {
 	int firstFriendlyPiece = -1;
 	int target = startTile + dir;
 	int pinnedPieceTile;
 	bool blockedByNonKing = false;
-	std::vector<int> pinLOS;
+	TileList pinLOS;
 
 	while (min <= target && target <= max)
 	{
@@ -844,7 +884,7 @@ void Board::CalcSlidingMovesOneDir(int startTile, int dir, int min, int max, int
 	}
 }
 
-void Board::CalcKnightMovesOneDir(int startTile, int dir, int kingPos, std::vector<int>& checkLOS, std::vector<int>& attackingTiles)
+void Board::CalcKnightMovesOneDir(int startTile, int dir, int kingPos, TileList& checkLOS, std::vector<int>& attackingTiles)
 {
 	int target = startTile + dir;
 	if (BlockedByOwnPiece(startTile, target))
@@ -862,7 +902,7 @@ void Board::CalcKnightMovesOneDir(int startTile, int dir, int kingPos, std::vect
 	}
 }
 
-void Board::HandleFoundMoves(int startTile, bool& foundKing, std::vector<int>& checkLOS, std::vector<int>& attackingTiles)
+void Board::HandleFoundMoves(int startTile, bool& foundKing, TileList& checkLOS, std::vector<int>& attackingTiles)
 {
 	if (!foundKing)
 	{
@@ -878,7 +918,8 @@ void Board::HandleFoundMoves(int startTile, bool& foundKing, std::vector<int>& c
 
 void Board::CalcKingMoves(int startTile)
 {
-	std::vector<int> attackingTiles;
+	std::vector<int>& attackingTiles = foundMoves;
+	attackingTiles.clear();
 
 	int top = edgesFromTiles[startTile].top;
 	int bottom = edgesFromTiles[startTile].bottom;
@@ -1012,8 +1053,9 @@ void Board::CalcQueenMoves(int startTile)
 
 void Board::CalcBishopMoves(int startTile)
 {
-	std::vector<int> attackingTiles;
-	std::vector<int> checkLOS;
+	std::vector<int>& attackingTiles = foundMoves;
+	attackingTiles.clear();
+	TileList checkLOS;
 
 	PieceTeam team = pieces[startTile].GetTeam();
 
@@ -1046,8 +1088,9 @@ void Board::CalcBishopMoves(int startTile)
 
 void Board::CalcKnightMoves(int startTile)
 {
-	std::vector<int> attackingTiles;
-	std::vector<int> checkLOS;
+	std::vector<int>& attackingTiles = foundMoves;
+	attackingTiles.clear();
+	TileList checkLOS;
 
 	PieceTeam team = pieces[startTile].GetTeam();
 
@@ -1102,8 +1145,9 @@ void Board::CalcKnightMoves(int startTile)
 
 void Board::CalcRookMoves(int startTile)
 {
-	std::vector<int> attackingTiles;
-	std::vector<int> checkLOS;
+	std::vector<int>& attackingTiles = foundMoves;
+	attackingTiles.clear();
+	TileList checkLOS;
 
 	PieceTeam team = pieces[startTile].GetTeam();
 	
@@ -1137,7 +1181,8 @@ void Board::CalcRookMoves(int startTile)
 void Board::CalcPawnMoves(int startTile)
 {
 	// 4 cases, move forward by 1, move forward by 2 (only first move), take diagonal, take by en passant
-	std::vector<int> attackingTiles;
+	std::vector<int>& attackingTiles = foundMoves;
+	attackingTiles.clear();
 	int teamDir = pieces[startTile].GetTeam() == PieceTeam::WHITE ? 1 : -1;
 	int target;
 
@@ -1165,7 +1210,7 @@ void Board::CalcPawnMoves(int startTile)
 				attackingTiles.push_back(target);
 				if (pieces[target].GetType() == KING)
 				{
-					std::vector<int> checkLOS;
+					TileList checkLOS;
 					checkLOS.push_back(target);
 					AddCheckingPiece(startTile, checkLOS);
 				}
@@ -1193,7 +1238,7 @@ void Board::CalcPawnMoves(int startTile)
 				attackingTiles.push_back(target);
 				if (pieces[target].GetType() == KING)
 				{
-					std::vector<int> checkLOS;
+					TileList checkLOS;
 					checkLOS.push_back(target);
 					AddCheckingPiece(startTile, checkLOS);
 				}
@@ -1252,7 +1297,7 @@ void Board::CompleteTurn()
 
 	if (bVsComputer && currentTurn == compTeam && !bTesting && !bSearching)
 	{
-		std::thread([this] {this->PlayCompMove(); }).detach();
+		compMoveWorker->Run([this] { this->PlayCompMove(); });
 	}
 }
 
@@ -1488,7 +1533,7 @@ void Board::CalculateAttacks()
 	}
 }
 
-void Board::AddToMap(int startTile, std::vector<int> validMoves)
+void Board::AddToMap(int startTile, const std::vector<int>& validMoves)
 {
 	if (validMoves.empty())
 	{
@@ -1738,19 +1783,12 @@ bool Board::CanBlockCheck(int kingPos, int& moveCount)
 {
 	bool bCanBlockCheck = false;
 
-	std::set<int> checkingTiles;
-	if (currentTurn == PieceTeam::WHITE)
+	TileSet checkingTiles;
+	for (const CheckingPiece& piece : currentTurn == PieceTeam::WHITE ? checkingPiecesBlack : checkingPiecesWhite)
 	{
-		for (CheckingPiece piece : checkingPiecesBlack)
+		for (int tile : piece.lineOfSight)
 		{
-			std::copy(piece.lineOfSight.begin(), piece.lineOfSight.end(), std::inserter(checkingTiles, checkingTiles.end()));
-		}
-	}
-	else
-	{
-		for (CheckingPiece piece : checkingPiecesWhite)
-		{
-			std::copy(piece.lineOfSight.begin(), piece.lineOfSight.end(), std::inserter(checkingTiles, checkingTiles.end()));
+			checkingTiles.insert(tile);
 		}
 	}
 
@@ -1806,7 +1844,7 @@ bool Board::MoveTakesCheckingPiece(int endTile) const
 	return false;
 }
 
-void Board::AddCheckingPiece(int startTile, const std::vector<int>& checkLOS)
+void Board::AddCheckingPiece(int startTile, const TileList& checkLOS)
 {
 	if (pieces[startTile].GetTeam() == PieceTeam::WHITE)
 	{
@@ -1940,24 +1978,15 @@ void Board::ClearValidCheckMoves()
 
 void Board::ClearPinnedPieces()
 {
-	for (PinnedPiece* piece : pinnedPiecesWhite)
-	{
-		delete piece;
-	}
 	pinnedPiecesWhite.clear();
-
-	for (PinnedPiece* piece : pinnedPiecesBlack)
-	{
-		delete piece;
-	}
 	pinnedPiecesBlack.clear();
 }
 
-void Board::AddPinnedPiece(int startTile, const std::vector<int>& pinLOS)
+void Board::AddPinnedPiece(int startTile, const TileList& pinLOS)
 {
-	PinnedPiece* piece = new PinnedPiece();
-	piece->tile = startTile;
-	piece->lineOfSight = pinLOS;
+	PinnedPiece piece;
+	piece.tile = startTile;
+	piece.lineOfSight = pinLOS;
 
 	if (pieces[startTile].GetTeam() == PieceTeam::WHITE)
 	{
@@ -1973,26 +2002,26 @@ void Board::HandlePinnedPieces()
 {
 	if (currentTurn == PieceTeam::WHITE)
 	{
-		for (PinnedPiece* piece : pinnedPiecesWhite)
+		for (const PinnedPiece& piece : pinnedPiecesWhite)
 		{
-			for (int i = attackMapWhite[piece->tile].size() - 1; i >= 0; i--)
+			for (int i = attackMapWhite[piece.tile].size() - 1; i >= 0; i--)
 			{
-				if (!TileInContainer(attackMapWhite[piece->tile][i], piece->lineOfSight))
+				if (!TileInContainer(attackMapWhite[piece.tile][i], piece.lineOfSight))
 				{
-					attackMapWhite[piece->tile].erase(std::remove(attackMapWhite[piece->tile].begin(), attackMapWhite[piece->tile].end(), attackMapWhite[piece->tile][i]), attackMapWhite[piece->tile].end());
+					attackMapWhite[piece.tile].erase(std::remove(attackMapWhite[piece.tile].begin(), attackMapWhite[piece.tile].end(), attackMapWhite[piece.tile][i]), attackMapWhite[piece.tile].end());
 				}
 			}
 		}
 	}
 	else
 	{
-		for (PinnedPiece* piece : pinnedPiecesBlack)
+		for (const PinnedPiece& piece : pinnedPiecesBlack)
 		{
-			for (int i = attackMapBlack[piece->tile].size() - 1; i >= 0; i--)
+			for (int i = attackMapBlack[piece.tile].size() - 1; i >= 0; i--)
 			{
-				if (!TileInContainer(attackMapBlack[piece->tile][i], piece->lineOfSight))
+				if (!TileInContainer(attackMapBlack[piece.tile][i], piece.lineOfSight))
 				{
-					attackMapBlack[piece->tile].erase(std::remove(attackMapBlack[piece->tile].begin(), attackMapBlack[piece->tile].end(), attackMapBlack[piece->tile][i]), attackMapBlack[piece->tile].end());
+					attackMapBlack[piece.tile].erase(std::remove(attackMapBlack[piece.tile].begin(), attackMapBlack[piece.tile].end(), attackMapBlack[piece.tile][i]), attackMapBlack[piece.tile].end());
 				}
 			}
 		}
@@ -2027,6 +2056,11 @@ void Board::SetupGame(bool bTest)
 		ClearButtons();
 	}
 
+	if (evalBoard && !bTest)
+	{
+		evalBoard->NewGame();
+	}
+
 	SetupBoardFromFEN("rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR");
 	FindKings();
 	CalculateMoves();
@@ -2057,31 +2091,53 @@ void Board::RecoverPieceMovedState(const std::vector<PieceMovedState>& pieceMove
 
 void Board::HandleEval()
 {
+	if (bVsComputer && currentTurn == compTeam && InMapRange(lastMoveEnd) && evalBoard->PonderHit(lastMoveStart, lastMoveEnd, pieces[lastMoveEnd].GetType()))
+	{
+		// the pondering search is already on this position, so it carries on as the search for the computer's move
+		return;
+	}
+
 	evalBoard->StopEval();
-	evalBoard->SetFEN(BoardToFEN());
+	std::string fen = BoardToFEN();
+	evalBoard->SetFEN(fen);
 
 	std::vector<PieceMovedState> pieceMovedStates;
 	CapturePieceMovedState(pieceMovedStates);
 	evalBoard->SetMovedStates(pieceMovedStates);
 
+	if (bVsComputer && currentTurn != compTeam)
+	{
+		// while the player thinks, search the position after the reply the computer expects
+		evalBoard->StartPonder(DEPTH, fen);
+		return;
+	}
+
 	evalBoard->StartEval(DEPTH);
 }
 
 void Board::PlayCompMove()
 {
 	using namespace std::literals::chrono_literals;
-	
-	std::this_thread::sleep_for(1s);
-	evalBoard->StopEval();
 
-	while (evalBoard->IsSearching())
+	// give the search up to a second, then stop it and take the best move found so far
+	std::shared_future<EvalBoard::SearchResult> result = evalBoard->GetResult();
+	if (!result.valid())
 	{
-		std::this_thread::sleep_for(500ms);
+		printf("Computer has no search to take a move from!\n");
+		return;
+	}
+
+	if (result.wait_for(1s) != std::future_status::ready)
+	{
+		evalBoard->StopEval();
 	}
 	
-	if (!MovePiece(evalBoard->bestMoveStart, evalBoard->bestMoveEnd))
+	// a stop that lands before depth 1 finishes leaves no move, so play any legal one rather than stall the game
+	const EvalBoard::SearchResult& best = result.get();
+	if (!InMapRange(best.startTile) || !InMapRange(best.endTile) || !MovePiece(best.startTile, best.endTile))
 	{
 		printf("Computer cannot make optimal move from search!\n");
+		PlayCompMoveRandom();
 	}
 }
 
@@ -2112,22 +2168,9 @@ bool Board::CheckStalemate()
 {
 	if (currentTurn == PieceTeam::WHITE)
 	{
-		std::vector<int> movesToRemove;
-		for (int move : attackMapWhite[kingPosWhite])
-		{
-			if (TileInContainer(move, attackSetBlack))
-			{
-				movesToRemove.push_back(move);
-			}
-		}
-
-		if (!movesToRemove.empty())
-		{
-			for (int move : movesToRemove)
-			{
-				attackMapWhite[kingPosWhite].erase(std::remove(attackMapWhite[kingPosWhite].begin(), attackMapWhite[kingPosWhite].end(), move), attackMapWhite[kingPosWhite].end());
-			}
-		}
+		// the king can't move onto an attacked tile
+		std::vector<int>& kingMoves = attackMapWhite[kingPosWhite];
+		kingMoves.erase(std::remove_if(kingMoves.begin(), kingMoves.end(), [this](int move) { return attackSetBlack.count(move) > 0; }), kingMoves.end());
 
 		if (TileInContainer(kingPosWhite, attackSetBlack))
 		{
@@ -2144,23 +2187,9 @@ bool Board::CheckStalemate()
 	}
 	else
 	{
-		std::vector<int> movesToRemove;
-		for (int move : attackMapBlack[kingPosBlack])
-		{
-			if (TileInContainer(move, attackSetWhite))
-			{
-				movesToRemove.push_back(move);
-			}
-		}
-
-		if (!movesToRemove.empty())
-		{
-			for (int move : movesToRemove)
-			{
-				attackMapBlack[kingPosBlack].erase(std::remove(attackMapBlack[kingPosBlack].begin(), attackMapBlack[kingPosBlack].end(), move), attackMapBlack[kingPosBlack].end());
-
-			}
-		}
+		// the king can't move onto an attacked tile
+		std::vector<int>& kingMoves = attackMapBlack[kingPosBlack];
+		kingMoves.erase(std::remove_if(kingMoves.begin(), kingMoves.end(), [this](int move) { return attackSetWhite.count(move) > 0; }), kingMoves.end());
 
 		if (TileInContainer(kingPosBlack, attackSetWhite))
 		{
@@ -2210,7 +2239,7 @@ void Board::GameOver(PieceTeam winningTeam)
 // ========================================== UTILITY ==========================================
 
 template <typename T>
-bool Board::TileInContainer(int target, T container) const
+bool Board::TileInContainer(int target, const T& container) const
 {
 	return std::find(container.begin(), container.end(), target) != container.end();
 }
@@ -24,14 +24,16 @@
 
 #include "Shader.h"
 #include "Piece.h"
+#include "TileSet.h"
 
 class Button;
+class SearchWorker;
 
 class Board
 {
 public:
 	Board();
-	~Board();
+	virtual ~Board();
 
 	void Init(unsigned int windowWidth, unsigned int windowHeight, GLFWwindow* window, irrklang::ISoundEngine* sEngine);
 	void RenderScene(int selectedObjectId);
@@ -98,9 +100,12 @@ protected:
 
 	bool CheckLegalMove(int startTile, int endTile);
 
-	void CalcSlidingMovesOneDir(int startTile, int min, int max, int dir, int kingPos, bool& foundKing, std::vector<int>& checkLOS, std::vector<int>& attackingTiles);
-	void CalcKnightMovesOneDir(int startTile, int dir, int kingPos, std::vector<int>& checkLOS, std::vector<int>& attackingTiles);
-	void HandleFoundMoves(int startTile, bool& foundKing, std::vector<int>& checkLOS, std::vector<int>& attackingTiles);
+	void CalcSlidingMovesOneDir(int startTile, int min, int max, int dir, int kingPos, bool& foundKing, TileList& checkLOS, std::vector<int>& attackingTiles);
+	void CalcKnightMovesOneDir(int startTile, int dir, int kingPos, TileList& checkLOS, std::vector<int>& attackingTiles);
+	void HandleFoundMoves(int startTile, bool& foundKing, TileList& checkLOS, std::vector<int>& attackingTiles);
+
+	// moves of the piece being generated, reused for every piece so that generating moves doesn't allocate
+	std::vector<int> foundMoves;
 
 	void CalcKingMoves(int startTile);
 	void CalcQueenMoves(int startTile);
@@ -111,14 +116,25 @@ protected:
 
 	struct Move
 	{
+		Move()
+		{
+			startTile = -1;
+			endTile = -1;
+			score = 0;
+		}
+
 		Move(int start, int end)
 		{
 			startTile = start;
 			endTile = end;
+			score = 0;
 		}
 
 		int startTile;
 		int endTile;
+		int score; // move ordering score, higher is searched first
+
+		bool operator==(const Move& other) const { return startTile == other.startTile && endTile == other.endTile; }
 	};
 
 	void SetBestMoves(const std::vector<Move>& bestMoves);
@@ -153,19 +169,20 @@ protected:
 	std::vector<int> attackMapBlack[64];
 	void CalculateMoves();
 
-	std::set<int> attackSetWhite;
-	std::set<int> attackSetBlack;
+	TileSet attackSetWhite;
+	TileSet attackSetBlack;
 	void CalculateAttacks();
 	void AddToAttackSet(int startTile, int target);
 
-	std::set<int> kingXRay; // squares behind the king which checking pieces can see, king cannot escape to these squares
+	TileSet kingXRay; // squares behind the king which checking pieces can see, king cannot escape to these squares
 
 	template <typename T>
-	bool TileInContainer(int target, T container) const;
+	bool TileInContainer(int target, const T& container) const;
+	bool TileInContainer(int target, const TileSet& container) const { return container.count(target); }
 
 	bool InMapRange(int index) const { return 0 <= index && index < 64; }
 
-	void AddToMap(int startTile, std::vector<int> validMoves);
+	void AddToMap(int startTile, const std::vector<int>& validMoves);
 
 	int kingPosWhite;
 	int kingPosBlack;
@@ -181,20 +198,20 @@ protected:
 	{
 		PieceType pieceType;
 		int tile;
-		std::vector<int> lineOfSight;
+		TileList lineOfSight;
 	};
 
 	struct PinnedPiece
 	{
 		int tile;
-		std::vector<int> lineOfSight;
+		TileList lineOfSight;
 	};
 
-	std::vector<PinnedPiece*> pinnedPiecesWhite;
-	std::vector<PinnedPiece*> pinnedPiecesBlack;
+	std::vector<PinnedPiece> pinnedPiecesWhite;
+	std::vector<PinnedPiece> pinnedPiecesBlack;
 
 	void ClearPinnedPieces();
-	void AddPinnedPiece(int startTile, const std::vector<int>& pinLOS);
+	void AddPinnedPiece(int startTile, const TileList& pinLOS);
 	void HandlePinnedPieces();
 
 	bool MoveBlocksCheck(int startTile, int endTile);
@@ -208,7 +225,7 @@ protected:
 	int CalcValidCheckMoves();
 	void ClearValidCheckMoves();
 
-	void AddCheckingPiece(int startTile, const std::vector<int>& checkLOS);
+	void AddCheckingPiece(int startTile, const TileList& checkLOS);
 	void AddProtectedPieceToSet(int target);
 
 	std::vector<CheckingPiece> checkingPiecesWhite;
@@ -347,7 +364,14 @@ private:
 	bool bSetPromoSound;
 
 	const int DEPTH = 1;
+	const int SEARCH_THREADS = 1; // threads searching each move, more than 1 runs Lazy SMP helpers. 2 threads sharing one core played level with 1
+	const int MULTI_PV = 1;
+	const bool USE_NNUE = false; // evaluate with the network in NETWORK_FILE instead of the piece-square tables
+	const char* NETWORK_FILE = "networks/mychess.nnue";
+	const bool USE_EVAL_FILE = false; // piece values and piece-square tables from EVAL_FILE instead of the built in ones
+	const char* EVAL_FILE = "networks/eval.bin";
 
 	class EvalBoard* evalBoard;
+	SearchWorker* compMoveWorker;
 };
 
@@ -2,6 +2,14 @@
 
 #include <memory>
 #include <thread>
+#include <bit>
+#include <cmath>
+#include <random>
+#include <cassert>
+#include <climits>
+
+#include "AllocationCounter.h"
+#include "EvalTables.h"
 
 #ifdef TESTING
 #include "Timer.h"
@@ -16,14 +24,26 @@ EvalBoard::EvalBoard()
 
 	bTesting = false;
 	bSearching = false;
-	bShouldSearch = false;
+	bSearchEnd = false;
+	lastMoveStart = -1;
+	lastMoveEnd = -1;
 	maxDepth = 2;
 	eval = 0;
+	completedDepth = 0;
+	nodes = 0;
+	extensionLimit = 0;
+	evalScores = { 0, 0, 0, 0, 0, 0, 0, { 0, 0 } };
+	evalMode = EvalMode::TABLES;
+	evalParams = &defaultEvalParameters;
+	previousPVLength = 0;
+	multiPVCount = 1;
+	multiPVIndex = 0;
+	bHelper = false;
 }
 
 EvalBoard::~EvalBoard()
 {
-	bShouldSearch = false;
+	searchControl.Stop();
 	
 	for (PieceType type : promotionTypes)
 	{
@@ -31,11 +51,13 @@ EvalBoard::~EvalBoard()
 	}
 	promotionPieces.clear();
 
-	while (bSearching)
+	worker.Wait();
+
+	for (EvalBoard* helper : helpers)
 	{
-		using namespace std::literals::chrono_literals;
-		std::this_thread::sleep_for(5ms);
+		delete helper;
 	}
+	helpers.clear();
 }
 
 void EvalBoard::Init(Board* newBoard, irrklang::ISoundEngine* engine)
@@ -47,27 +69,168 @@ void EvalBoard::Init(Board* newBoard, irrklang::ISoundEngine* engine)
 	SetBoardCoords();
 	PrepEdges();
 	CalculateEdges();
+	PrepAttackMasks();
+	PrepReductions();
+	PrepZobristKeys();
+	PrepSearchStack();
+	ClearMoveOrdering();
+
+	transpositionTable = std::make_shared<TranspositionTable>();
 }
 
-void EvalBoard::StartEval(const int depth)
+void EvalBoard::InitHelper(EvalBoard* mainBoard)
+{
+	// helpers never render, so unlike Init() no promotion pieces are created for them
+	InitHeadless();
+	bHelper = true;
+	soundEngine = mainBoard->soundEngine;
+	board = mainBoard->board;
+	transpositionTable = mainBoard->transpositionTable;
+}
+
+void EvalBoard::InitHeadless()
+{
+	soundEngine = nullptr;
+	board = nullptr;
+
+	SetBoardCoords();
+	PrepEdges();
+	CalculateEdges();
+	PrepAttackMasks();
+	PrepReductions();
+	PrepZobristKeys();
+	PrepSearchStack();
+	ClearMoveOrdering();
+}
+
+void EvalBoard::SetThreadCount(int count)
 {
-	using namespace std::literals::chrono_literals;
+	StopEval();
+	worker.Wait();
 
-	while (bSearching)
+	int helperCount = std::max(count, 1) - 1;
+	while ((int)helpers.size() > helperCount)
 	{
-		bShouldSearch = false;
-		std::this_thread::sleep_for(5ms);
+		delete helpers.back();
+		helpers.pop_back();
 	}
-	
+
+	while ((int)helpers.size() < helperCount)
+	{
+		EvalBoard* helper = new EvalBoard();
+		helper->InitHelper(this);
+		helpers.push_back(helper);
+	}
+}
+
+void EvalBoard::StartEval(const int depth)
+{
+	StopEval();
+	worker.Wait();
+
+	maxDepth = depth;
+	currentTurn = board->GetCurrentTurn();
+	searchControl.Start();
+
+	resultPromise = std::promise<SearchResult>();
+	result = resultPromise.get_future().share();
+
+	worker.Run([this]
+		{
+			this->IterDeepSearch();
+
+			SearchControl::PublishedMove published = searchControl.GetPublished();
+			resultPromise.set_value(SearchResult{ published.startTile, published.endTile, published.eval, published.depth, multiPVLines });
+		});
+}
+
+void EvalBoard::StartPonder(const int depth, const std::string& position)
+{
+	// the reply the last search expected, read before Start() clears it
+	SearchControl::PublishedMove last = searchControl.GetPublished();
+
+	StopEval();
+	worker.Wait();
+
 	maxDepth = depth;
 	currentTurn = board->GetCurrentTurn();
+	searchControl.Start();
+
+	resultPromise = std::promise<SearchResult>();
+	result = resultPromise.get_future().share();
+
+	worker.Run([this, last, position]
+		{
+			if (this->SetupPonderPosition(Move(last.ponderStart, last.ponderEnd), position))
+			{
+				this->IterDeepSearch();
+			}
+
+			SearchControl::PublishedMove published = searchControl.GetPublished();
+			resultPromise.set_value(SearchResult{ published.startTile, published.endTile, published.eval, published.depth, multiPVLines });
+		});
+}
+
+bool EvalBoard::PonderHit(int startTile, int endTile, PieceType promotedType)
+{
+	return searchControl.PonderHit(startTile, endTile, promotedType);
+}
+
+bool EvalBoard::SetupPonderPosition(Move predicted, const std::string& position)
+{
+	bSearching = true;
+	SetupBoardFromFEN(fen);
+	RecoverPieceMovedState(pieceMovedStates);
+	CalculateMoves();
+
+	// a stale FEN would have the guess played on some earlier position, and a hit would then play its search's move
+	if (BoardToFEN() != position)
+	{
+#ifdef TESTING
+		assert(false && "ponder position doesn't match the board");
+#endif
+		bSearching = false;
+		return false;
+	}
+
+	// without a reply from the last search's PV, fall back to the move the table holds for this position
+	TranspositionTable::Entry hashEntry;
+	if (!InMapRange(predicted.startTile) && transpositionTable->Probe(ComputeHash(), hashEntry))
+	{
+		predicted = Move(hashEntry.startTile, hashEntry.endTile);
+	}
+
+	if (!InMapRange(predicted.startTile) || !InMapRange(predicted.endTile) || !MovePiece(predicted.startTile, predicted.endTile))
+	{
+		bSearching = false;
+		return false;
+	}
+
+	// search from the position after the guessed move as if it had been played
+	fen = BoardToFEN();
+	pieceMovedStates.clear();
+	CapturePieceMovedState(pieceMovedStates);
 
-	std::thread([this] { this->IterDeepSearch(); }).detach();
+	searchControl.StartPondering(predicted.startTile, predicted.endTile, pieces[predicted.endTile].GetType());
+#ifdef TESTING
+	printf("Pondering on %s %s\n", ToBoard(predicted.startTile).c_str(), ToBoard(predicted.endTile).c_str());
+#endif
+	return true;
 }
 
 void EvalBoard::StopEval()
 {
-	bShouldSearch = false;
+	searchControl.Stop();
+}
+
+void EvalBoard::NewGame()
+{
+	StopEval();
+	worker.Wait();
+
+	transpositionTable->Clear();
+	ClearMoveOrdering();
+	previousPVLength = 0;
 }
 
 void EvalBoard::ShannonTestCallback()
@@ -110,36 +273,30 @@ int EvalBoard::ShannonTest(const int ply, const int depth)
 		return 1;
 	}
 
-	// save current board state (locations and whether piece moved for castling etc)
-	std::unique_ptr<BoardState> boardState = std::make_unique<BoardState>(this);
-
-	std::vector<int> attackMap[64];
-	if (currentTurn == PieceTeam::WHITE)
-	{
-		std::copy(std::begin(attackMapWhite), std::end(attackMapWhite), std::begin(attackMap));
-	}
-	else
+	if (ply >= MAX_PLY)
 	{
-		std::copy(std::begin(attackMapBlack), std::end(attackMapBlack), std::begin(attackMap));
+		return 0;
 	}
 
-	std::vector<CheckingPiece> checkingPieces = currentTurn == PieceTeam::WHITE ? checkingPiecesBlack : checkingPiecesWhite;
+	// save current board state (locations and whether piece moved for castling etc)
+	SearchFrame& frame = searchStack[ply];
+	SaveFrame(frame);
+	std::vector<int> (&attackMap)[64] = frame.attackMap;
 
 	// for each move
 	for (size_t startTile = 0; startTile < 64; startTile++)
 	{
-		std::vector<int> movesFound;
-
 		if (!IsActivePiece(startTile) || pieces[startTile].GetTeam() != currentTurn || attackMap[startTile].empty())
 			continue;
 
-		for (int move : attackMap[startTile])
+		for (size_t i = 0; i < attackMap[startTile].size(); i++)
 		{
-			if (TileInContainer(move, movesFound))
+			// the moves before this one in the list are the ones already found for this piece
+			int move = attackMap[startTile][i];
+			if (std::find(attackMap[startTile].begin(), attackMap[startTile].begin() + i, move) != attackMap[startTile].begin() + i)
 			{
 				printf("MOVE ALREADY IN CONTAINER! FOUND MORE THAN ONCE!\n");
 			}
-			movesFound.push_back(move);
 
 			// since CompleteTurn() wipes attack maps, copy the relevant attack map entry so that checks can be carried out
 			currentTurn == PieceTeam::WHITE ? attackMapWhite[startTile].clear() : attackMapBlack[startTile].clear();
@@ -158,25 +315,7 @@ int EvalBoard::ShannonTest(const int ply, const int depth)
 			moveCount += ShannonTest(ply + 1, depth);
 
 			// undo move by restoring board state
-			RecoverBoardState(boardState.get());
-			if (currentTurn == PieceTeam::WHITE)
-			{
-				checkingPiecesBlack = checkingPieces;
-			}
-			else
-			{
-				checkingPiecesWhite = checkingPieces;
-			}
-
-			// restore attackMap, recovering from cache rather than calculating again
-			if (currentTurn == PieceTeam::WHITE)
-			{
-				std::copy(std::begin(attackMap), std::end(attackMap), std::begin(attackMapWhite));
-			}
-			else
-			{
-				std::copy(std::begin(attackMap), std::end(attackMap), std::begin(attackMapBlack));
-			}
+			UndoMove(frame);
 		}
 	}
 
@@ -188,271 +327,1930 @@ void EvalBoard::SetMovedStates(const std::vector<PieceMovedState>& pieceMovedSta
 	this->pieceMovedStates = pieceMovedStates;
 }
 
-void EvalBoard::RecoverBoardState(BoardState* boardState)
+void EvalBoard::RecoverBoardState(const BoardState& boardState)
 {
-	SetupBoardFromFEN(boardState->fen);
-	RecoverPieceMovedState(boardState->pieceMovedStates);
+	for (int i = 0; i < 64; i++)
+	{
+		if (boardState.types[i] == PieceType::NONE)
+		{
+			pieces[i].ClearPiece();
+		}
+		else if (pieces[i].GetTeam() != boardState.teams[i] || pieces[i].GetType() != boardState.types[i])
+		{
+			pieces[i].SetPiece(boardState.teams[i], boardState.types[i]);
+		}
+		pieces[i].bMoved = boardState.bMoved[i];
+	}
+	enPassantOwner = boardState.enPassantOwner;
+	lastEnPassantIndex = -1;
+
 	ClearPinnedPieces();
-	currentTurn = boardState->turn;
+	kingXRay = boardState.kingXRay;
+	attackSetWhite = boardState.attackSetWhite;
+	attackSetBlack = boardState.attackSetBlack;
+	currentTurn = boardState.turn;
 	bGameOver = false;
-	bInCheckWhite = boardState->bLocalCheckWhite;
-	bInCheckBlack = boardState->bLocalCheckBlack;
-	lastMoveStart = boardState->lastMoveStart;
-	lastMoveEnd = boardState->lastMoveEnd;
+	bInCheckWhite = boardState.bLocalCheckWhite;
+	bInCheckBlack = boardState.bLocalCheckBlack;
+	lastMoveStart = boardState.lastMoveStart;
+	lastMoveEnd = boardState.lastMoveEnd;
+	evalScores = boardState.evalScores;
 }
 
 int EvalBoard::EvaluatePosition() const
 {
-	int eval = CalcWhiteValue() - CalcBlackValue();
-	int perspective = currentTurn == PieceTeam::WHITE ? 1 : -1;
-	return eval * perspective;
+	bool bExact = true;
+	return EvaluatePosition(-INFINITE_EVAL, INFINITE_EVAL, bExact);
 }
 
-void EvalBoard::HandleEval()
+int EvalBoard::EvaluatePosition(int alpha, int beta, bool& bExact) const
 {
-	return;
-}
+#ifdef TESTING
+	assert(evalScores == CalcEvalScores());
+#endif
 
-int EvalBoard::Search(const int ply, const int depth)
-{
-	int eval = 0;
+	bExact = true;
 
-	if (ply > depth)
+	// kept clear of mate scores whatever the network's weights
+	if (evalMode == EvalMode::NNUE)
+	{
+		return std::clamp(network->Evaluate(accumulator, currentTurn), -MATE_BOUND + 1, MATE_BOUND - 1);
+	}
+
+	int perspective = currentTurn == PieceTeam::WHITE ? 1 : -1;
+	const MaterialTable::Entry& material = ProbeMaterial();
+	if (material.endgameFunction != nullptr)
 	{
-		return EvaluatePosition();
+		return material.endgameFunction(*this, material.strongTeam) * perspective;
 	}
 
-	int bestEval = -999;
+	int middlegame = evalScores.middlegame + material.middlegame;
+	int endgame = evalScores.endgame + material.endgame;
+	int lazyEval = BlendPhases(middlegame, endgame, material) * perspective;
+	if (lazyEval - LAZY_EVAL_MARGIN >= beta || lazyEval + LAZY_EVAL_MARGIN <= alpha)
+	{
+		bExact = false;
+		return lazyEval;
+	}
 
-	std::vector<Move> bestMoves;
+	const PawnTable::Entry& pawns = ProbePawns();
+	middlegame += pawns.middlegame;
+	endgame += pawns.endgame;
 
-	// save current board state (locations, whether piece moved for castling etc)
-	std::unique_ptr<BoardState> boardState = std::make_unique<BoardState>(this);
+	EvaluateActivity(pawns, middlegame, endgame);
+	return BlendPhases(middlegame, endgame, material) * perspective;
+}
 
-	std::vector<int> attackMap[64];
-	if (currentTurn == PieceTeam::WHITE)
+int EvalBoard::BlendPhases(int middlegame, int endgame, const MaterialTable::Entry& material) const
+{
+	// a side that can't win at all only draws, whatever its pieces' tiles are worth
+	int scale = EndgameScale(endgame, material);
+	if (scale == 0)
 	{
-		std::copy(std::begin(attackMapWhite), std::end(attackMapWhite), std::begin(attackMap));
+		return 0;
 	}
-	else
+
+	endgame = endgame * scale / MaterialTable::SCALE_NORMAL;
+	return (middlegame * material.phase + endgame * (PHASE_MAX - material.phase)) / PHASE_MAX;
+}
+
+int EvalBoard::EndgameScale(int endgame, const MaterialTable::Entry& material) const
+{
+	// opposite coloured bishops are hard to win with whatever else is left, so the endgame counts for half
+	int scale = material.scale[endgame >= 0 ? 0 : 1];
+	if (material.bSingleBishops && HasOppositeBishops())
 	{
-		std::copy(std::begin(attackMapBlack), std::end(attackMapBlack), std::begin(attackMap));
+		scale /= 2;
 	}
+	return scale;
+}
 
-	std::vector<CheckingPiece> checkingPieces = currentTurn == PieceTeam::WHITE ? checkingPiecesBlack : checkingPiecesWhite;
-	std::vector<int> movesFound;
+int EvalBoard::TracePosition(const std::string& placement, PieceTeam turn, EvalTrace& trace)
+{
+	bSearching = true;
+	SetupBoardFromFEN(placement);
+	currentTurn = turn;
+	// the pins of the last position traced would otherwise still cut down the moves of whatever stands on their tiles
+	ClearPinnedPieces();
+	CalculateMoves();
+	PrepEvaluation();
 
-	// for each move
-	for (size_t startTile = 0; startTile < 64; startTile++)
+	trace = EvalTrace{};
+	for (int i = 0; i < 64; i++)
 	{
-		if (!bShouldSearch)
+		PieceType type = pieces[i].GetType();
+		if (type >= EN_PASSANT)
 		{
-			bEarlyExit = true;
-			return -1;
-		}
-		
-		if (!IsActivePiece(startTile) || pieces[startTile].GetTeam() != currentTurn || attackMap[startTile].empty())
 			continue;
+		}
 
-		for (int move : attackMap[startTile])
-		{
-			movesFound.push_back(move);
+		int square = pieces[i].GetTeam() == PieceTeam::WHITE ? i : i ^ 56;
+		int sign = pieces[i].GetTeam() == PieceTeam::WHITE ? 1 : -1;
+		TraceParameter(&trace, evalParams->middlegameValues[type], sign);
+		TraceParameter(&trace, evalParams->endgameValues[type], sign);
+		TraceParameter(&trace, evalParams->middlegameTables[type][square], sign);
+		TraceParameter(&trace, evalParams->endgameTables[type][square], sign);
+	}
 
-			// since CompleteTurn() wipes attack maps, copy the relevant attack map entry so that checks can be carried out
-			currentTurn == PieceTeam::WHITE ? attackMapWhite[startTile].clear() : attackMapBlack[startTile].clear();
-			for (int tileMove : attackMap[startTile])
-			{
-				currentTurn == PieceTeam::WHITE ? attackMapWhite[startTile].push_back(tileMove) : attackMapBlack[startTile].push_back(tileMove);
-			}
+	// worked out directly rather than through the caches, which only hold the scores
+	MaterialTable::Entry material;
+	PawnTable::Entry pawns;
+	EvaluateMaterial(material, &trace);
+	EvaluatePawns(pawns, &trace);
 
-			// play move
-			MovePiece(startTile, move);
+	int middlegame = evalScores.middlegame + material.middlegame + pawns.middlegame;
+	int endgame = evalScores.endgame + material.endgame + pawns.endgame;
+	EvaluateActivity(pawns, middlegame, endgame, &trace);
 
-			// calc deeper moves with recursion and add
-			eval = -Search(ply + 1, depth);
+	trace.phase = material.phase;
+	trace.scale = EndgameScale(endgame, material);
+	trace.bLinear = material.endgameFunction == nullptr;
 
-			if (eval > bestEval && ply == 1)
-			{
-				bestEval = eval;
-				bestMoves.clear();
-				bestMoves.emplace(bestMoves.end(), startTile, move);
-			}
-			else if (eval == bestEval && ply == 1)
-			{
-				bestMoves.emplace(bestMoves.end(), startTile, move);
-			}
-			else if (eval >= bestEval)
-			{
-				bestEval = eval;
-			}
+	int eval = EvaluatePosition();
+	return currentTurn == PieceTeam::WHITE ? eval : -eval;
+}
 
-			// undo move by restoring board state
-			RecoverBoardState(boardState.get());
-			if (currentTurn == PieceTeam::WHITE)
-			{
-				checkingPiecesBlack = checkingPieces;
-			}
-			else
-			{
-				checkingPiecesWhite = checkingPieces;
-			}
-			
-			// restore attackMap, recovering from cache rather than calculating again
-			if (currentTurn == PieceTeam::WHITE)
-			{
-				std::copy(std::begin(attackMap), std::end(attackMap), std::begin(attackMapWhite));
-			}
-			else
-			{
-				std::copy(std::begin(attackMap), std::end(attackMap), std::begin(attackMapBlack));
-			}
-		}
+void EvalBoard::TraceParameter(EvalTrace* trace, const int32_t& parameter, int count) const
+{
+	if (trace != nullptr)
+	{
+		trace->coefficients[&parameter - reinterpret_cast<const int32_t*>(evalParams)] += count;
 	}
+}
+
+void EvalBoard::TraceParameters(EvalTrace* trace, const int32_t (&pair)[2], int count) const
+{
+	TraceParameter(trace, pair[0], count);
+	TraceParameter(trace, pair[1], count);
+}
 
-	if (ply == 1)
+int EvalBoard::StaticEval(int alpha, int beta) const
+{
+	// once a king has been taken the move lists depend on where it last stood, so only a position with both kings is
+	// sure to evaluate the same every time and worth caching
+	bool bBothKings = MaterialTable::Count(evalScores.materialKey, PieceTeam::WHITE, KING) == 1 &&
+		MaterialTable::Count(evalScores.materialKey, PieceTeam::BLACK, KING) == 1;
+	bool bExact = true;
+	if (!bBothKings)
 	{
-		SetBestMoves(bestMoves);
+		return EvaluatePosition(alpha, beta, bExact);
 	}
 
-	if (movesFound.empty())
+	uint64_t key = currentTurn == PieceTeam::BLACK ? evalScores.pieceKey ^ zobristBlackToMove : evalScores.pieceKey;
+	int eval = 0;
+	if (evalCache.Probe(key, eval))
 	{
-		if ((currentTurn == PieceTeam::WHITE && bInCheckWhite) || (currentTurn == PieceTeam::BLACK && bInCheckBlack))
+#ifdef TESTING
+		assert(eval == EvaluatePosition());
+#endif
+		return eval;
+	}
+
+	eval = EvaluatePosition(alpha, beta, bExact);
+	if (bExact)
+	{
+		evalCache.Store(key, eval);
+	}
+	return eval;
+}
+
+EvalBoard::EvalScores EvalBoard::CalcEvalScores() const
+{
+	EvalScores scores = { 0, 0, 0, 0, 0, 0, 0, { 0, 0 } };
+
+	for (int i = 0; i < 64; i++)
+	{
+		PieceType type = pieces[i].GetType();
+		if (type == EN_PASSANT)
+		{
+			scores.enPassantKey ^= zobristPieces[(int)pieces[i].GetTeam()][EN_PASSANT][i];
+			continue;
+		}
+		else if (type == NONE)
+		{
+			continue;
+		}
+
+		// tables are from white's side, black reads them flipped
+		if (pieces[i].GetTeam() == PieceTeam::WHITE)
 		{
-			return -999; // nothing is worse than checkmate
+			scores.middlegame += evalParams->middlegameValues[type] + evalParams->middlegameTables[type][i];
+			scores.endgame += evalParams->endgameValues[type] + evalParams->endgameTables[type][i];
 		}
 		else
 		{
-			return 0; // stalemate
+			scores.middlegame -= evalParams->middlegameValues[type] + evalParams->middlegameTables[type][i ^ 56];
+			scores.endgame -= evalParams->endgameValues[type] + evalParams->endgameTables[type][i ^ 56];
+		}
+		scores.materialKey += MaterialTable::PieceKey(pieces[i].GetTeam(), type);
+		scores.pieceKey ^= zobristPieces[(int)pieces[i].GetTeam()][type][i];
+		if (!pieces[i].bMoved && (type == KING || type == ROOK || type == PAWN))
+		{
+			scores.unmovedKey ^= zobristUnmoved[i];
+		}
+
+		int side = pieces[i].GetTeam() == PieceTeam::WHITE ? 0 : 1;
+		if (type == PAWN)
+		{
+			scores.pawnKey ^= zobristPieces[(int)pieces[i].GetTeam()][PAWN][i];
+		}
+		else if (type == KING)
+		{
+			scores.kingTiles[side] = i;
 		}
 	}
 
-	return bestEval;
+	return scores;
 }
 
-int EvalBoard::SearchAllCaptures(bool bCaptureFound)
+const PawnTable::Entry& EvalBoard::ProbePawns() const
 {
-	if (!bCaptureFound)
+	PawnTable::Entry& entry = pawnTable.Slot(evalScores.pawnKey);
+	if (entry.key != evalScores.pawnKey)
 	{
-		return EvaluatePosition();
+		EvaluatePawns(entry);
+		entry.key = evalScores.pawnKey;
 	}
-	
-	int eval = 0;
-	int bestEval = -999;
-	bCaptureFound = false;
-
-	// save current board state (locations, whether piece moved for castling etc)
-	std::unique_ptr<BoardState> boardState = std::make_unique<BoardState>(this);
+	return entry;
+}
 
-	std::vector<int> attackMap[64];
-	if (currentTurn == PieceTeam::WHITE)
-	{
-		std::copy(std::begin(attackMapWhite), std::end(attackMapWhite), std::begin(attackMap));
-	}
-	else
+const MaterialTable::Entry& EvalBoard::ProbeMaterial() const
+{
+	MaterialTable::Entry& entry = materialTable.Slot(evalScores.materialKey);
+	if (entry.key != evalScores.materialKey)
 	{
-		std::copy(std::begin(attackMapBlack), std::end(attackMapBlack), std::begin(attackMap));
+		EvaluateMaterial(entry);
+		entry.key = evalScores.materialKey;
 	}
+	return entry;
+}
 
-	std::vector<CheckingPiece> checkingPieces = currentTurn == PieceTeam::WHITE ? checkingPiecesBlack : checkingPiecesWhite;
-	std::vector<int> movesFound;
+void EvalBoard::EvaluateMaterial(MaterialTable::Entry& entry, EvalTrace* trace) const
+{
+	int counts[2][6] = {};
+	int nonPawn[2] = { 0, 0 };
 
-	// for each move
-	for (size_t startTile = 0; startTile < 64; startTile++)
+	entry.middlegame = 0;
+	entry.endgame = 0;
+	entry.phase = 0;
+	for (int side = 0; side < 2; side++)
 	{
-		if (!bShouldSearch)
+		PieceTeam team = side == 0 ? PieceTeam::WHITE : PieceTeam::BLACK;
+		for (int type = QUEEN; type <= PAWN; type++)
 		{
-			bEarlyExit = true;
-			return -1;
+			counts[side][type] = MaterialTable::Count(evalScores.materialKey, team, (PieceType)type);
+			entry.phase += counts[side][type] * evalParams->phaseWeights[type];
+			if (type != PAWN)
+			{
+				nonPawn[side] += counts[side][type] * evalParams->middlegameValues[type];
+			}
 		}
 
-		if (!IsActivePiece(startTile) || pieces[startTile].GetTeam() != currentTurn || attackMap[startTile].empty())
-			continue;
-
-		for (int move : attackMap[startTile])
+		int extraPawns = counts[side][PAWN] - 5;
+		int middlegame = extraPawns * (counts[side][KNIGHT] * evalParams->knightPawns[0] + counts[side][ROOK] * evalParams->rookPawns[0]);
+		int endgame = extraPawns * (counts[side][KNIGHT] * evalParams->knightPawns[1] + counts[side][ROOK] * evalParams->rookPawns[1]);
+		if (counts[side][BISHOP] >= 2)
 		{
-			if (!IsActivePiece(move))
-			{
-				continue;
-			}
+			middlegame += evalParams->bishopPair[0];
+			endgame += evalParams->bishopPair[1];
+			TraceParameters(trace, evalParams->bishopPair, side == 0 ? 1 : -1);
+		}
+		TraceParameters(trace, evalParams->knightPawns, (side == 0 ? 1 : -1) * extraPawns * counts[side][KNIGHT]);
+		TraceParameters(trace, evalParams->rookPawns, (side == 0 ? 1 : -1) * extraPawns * counts[side][ROOK]);
 
-			movesFound.push_back(move);
+		entry.middlegame += side == 0 ? middlegame : -middlegame;
+		entry.endgame += side == 0 ? endgame : -endgame;
+	}
 
-			// since CompleteTurn() wipes attack maps, copy the relevant attack map entry so that checks can be carried out
-			currentTurn == PieceTeam::WHITE ? attackMapWhite[startTile].clear() : attackMapBlack[startTile].clear();
-			for (int tileMove : attackMap[startTile])
-			{
-				currentTurn == PieceTeam::WHITE ? attackMapWhite[startTile].push_back(tileMove) : attackMapBlack[startTile].push_back(tileMove);
-			}
+	// early promotions can take the phase past the starting position
+	entry.phase = std::min(entry.phase, PHASE_MAX);
 
-			// play move
-			if (MovePiece(startTile, move))
-			{
-				bCaptureFound = true;
-				printf("%s takes %s\n", ToBoard(startTile).c_str(), ToBoard(move).c_str());
-			}
+	int knightValue = evalParams->middlegameValues[KNIGHT];
+	int bishopValue = evalParams->middlegameValues[BISHOP];
+	int rookValue = evalParams->middlegameValues[ROOK];
+	entry.bSingleBishops = counts[0][BISHOP] == 1 && counts[1][BISHOP] == 1 && nonPawn[0] == bishopValue && nonPawn[1] == bishopValue;
+	entry.endgameFunction = nullptr;
+	entry.strongTeam = PieceTeam::NONE;
+	for (int side = 0; side < 2; side++)
+	{
+		PieceTeam team = side == 0 ? PieceTeam::WHITE : PieceTeam::BLACK;
+		int other = side ^ 1;
 
-			// calc deeper moves with recursion and add
-			eval = -SearchAllCaptures(bCaptureFound);
+		// without pawns, being up less than a bishop is rarely enough to win, and without a rook's worth not at all
+		entry.scale[side] = MaterialTable::SCALE_NORMAL;
+		if (counts[side][PAWN] == 0 && nonPawn[side] - nonPawn[other] <= bishopValue)
+		{
+			entry.scale[side] = nonPawn[side] < rookValue ? 0 : nonPawn[other] <= bishopValue ? 4 : 14;
+		}
 
-			if (eval >= bestEval)
-			{
-				bestEval = eval;
-			}
+		// two knights are worth more than a rook but can't force mate on their own
+		if (counts[side][PAWN] == 0 && counts[side][KNIGHT] <= 2 && nonPawn[side] == counts[side][KNIGHT] * knightValue)
+		{
+			entry.scale[side] = 0;
+		}
 
-			// undo move by restoring board state
-			RecoverBoardState(boardState.get());
-			if (currentTurn == PieceTeam::WHITE)
-			{
-				checkingPiecesBlack = checkingPieces;
-			}
-			else
-			{
-				checkingPiecesWhite = checkingPieces;
-			}
+		if (nonPawn[other] != 0 || counts[other][PAWN] != 0)
+		{
+			continue;
+		}
 
-			// restore attackMap, recovering from cache rather than calculating again
-			if (currentTurn == PieceTeam::WHITE)
-			{
-				std::copy(std::begin(attackMap), std::end(attackMap), std::begin(attackMapWhite));
-			}
-			else
-			{
-				std::copy(std::begin(attackMap), std::end(attackMap), std::begin(attackMapBlack));
-			}
+		if (counts[side][PAWN] == 0 && counts[side][BISHOP] == 1 && counts[side][KNIGHT] == 1 &&
+			nonPawn[side] == bishopValue + knightValue)
+		{
+			entry.endgameFunction = &EvalBoard::EvaluateKBNK;
+			entry.strongTeam = team;
+		}
+		else if (nonPawn[side] >= rookValue && entry.scale[side] != 0)
+		{
+			entry.endgameFunction = &EvalBoard::EvaluateKXK;
+			entry.strongTeam = team;
 		}
 	}
+}
 
-	if (!bCaptureFound)
-	{
-		return SearchAllCaptures(bCaptureFound);
+bool EvalBoard::HasOppositeBishops() const
+{
+	int colours[3] = { -1, -1, -1 };
+	for (int i = 0; i < 64; i++)
+	{
+		if (pieces[i].GetType() == BISHOP)
+		{
+			colours[(int)pieces[i].GetTeam()] = (i / 8 + i % 8) % 2;
+		}
+	}
+	return colours[(int)PieceTeam::WHITE] != colours[(int)PieceTeam::BLACK];
+}
+
+static int TileDistance(int a, int b)
+{
+	return std::max(std::abs(a % 8 - b % 8), std::abs(a / 8 - b / 8));
+}
+
+// files and ranks from the central four tiles, 0 there and 6 in a corner
+static int CentreDistance(int tile)
+{
+	return std::max(3 - tile % 8, tile % 8 - 4) + std::max(3 - tile / 8, tile / 8 - 4);
+}
+
+int EvalBoard::EvaluateKXK(const EvalBoard& board, PieceTeam strongTeam)
+{
+	int strong = strongTeam == PieceTeam::WHITE ? 0 : 1;
+	int strongKing = board.evalScores.kingTiles[strong];
+	int weakKing = board.evalScores.kingTiles[strong ^ 1];
+
+	int score = (strong == 0 ? board.evalScores.endgame : -board.evalScores.endgame) + 20 * CentreDistance(weakKing) +
+		10 * (7 - TileDistance(strongKing, weakKing));
+	return strong == 0 ? score : -score;
+}
+
+int EvalBoard::EvaluateKBNK(const EvalBoard& board, PieceTeam strongTeam)
+{
+	int strong = strongTeam == PieceTeam::WHITE ? 0 : 1;
+	int strongKing = board.evalScores.kingTiles[strong];
+	int weakKing = board.evalScores.kingTiles[strong ^ 1];
+
+	// only the corners of the bishop's colour can be mated in, a8 and h1 for one colour, h8 and a1 for the other
+	int cornerDistance = 7;
+	for (int i = 0; i < 64; i++)
+	{
+		if (board.pieces[i].GetType() == BISHOP)
+		{
+			bool bA8Colour = (i / 8 + i % 8) % 2 == 0;
+			cornerDistance = std::min(TileDistance(weakKing, bA8Colour ? 0 : 7), TileDistance(weakKing, bA8Colour ? 63 : 56));
+		}
+	}
+
+	int score = (strong == 0 ? board.evalScores.endgame : -board.evalScores.endgame) + 30 * (7 - cornerDistance) +
+		10 * (7 - TileDistance(strongKing, weakKing));
+	return strong == 0 ? score : -score;
+}
+
+void EvalBoard::EvaluateActivity(const PawnTable::Entry& pawns, int& middlegame, int& endgame, EvalTrace* trace) const
+{
+	for (int side = 0; side < 2; side++)
+	{
+		PieceTeam team = side == 0 ? PieceTeam::WHITE : PieceTeam::BLACK;
+		int sign = side == 0 ? 1 : -1;
+
+		// the king's pawn shield depends on where the king is, so it is counted from the cached pawn masks every time
+		int shield = std::popcount(pawns.pawns[side] & pawnShieldMasks[(int)team][evalScores.kingTiles[side]]);
+		middlegame += sign * shield * evalParams->pawnShield[0];
+		endgame += sign * shield * evalParams->pawnShield[1];
+		TraceParameters(trace, evalParams->pawnShield, sign * shield);
+
+		const std::vector<int>(&attackMap)[64] = side == 0 ? attackMapWhite : attackMapBlack;
+		int enemyKing = evalScores.kingTiles[side ^ 1];
+		uint64_t kingZone = kingMasks[enemyKing] | 1ull << enemyKing;
+		uint64_t safeTiles = ~pawns.attacks[side ^ 1];
+
+		int mobilityMiddlegame = 0;
+		int mobilityEndgame = 0;
+		int attackers = 0;
+		int attackUnits = 0;
+		for (int tile = 0; tile < 64; tile++)
+		{
+			PieceType type = pieces[tile].GetType();
+			if (pieces[tile].GetTeam() != team || type == KING || type >= PAWN)
+			{
+				continue;
+			}
+
+			uint64_t moves = 0;
+			for (int target : attackMap[tile])
+			{
+				moves |= 1ull << target;
+			}
+
+			int safeMoves = std::popcount(moves & safeTiles) - evalParams->mobilityBaseline[type];
+			mobilityMiddlegame += safeMoves * evalParams->mobility[type][0];
+			mobilityEndgame += safeMoves * evalParams->mobility[type][1];
+			TraceParameters(trace, evalParams->mobility[type], sign * safeMoves);
+
+			if (moves & kingZone)
+			{
+				attackers++;
+				attackUnits += evalParams->kingAttackWeights[type] * std::popcount(moves & kingZone);
+			}
+		}
+
+		// a lone attacker can rarely get at the king by itself
+		int danger = 0;
+		if (attackers >= 2)
+		{
+			const int32_t& kingDanger = evalParams->kingDanger[std::min(attackUnits, 63)];
+			danger = kingDanger;
+			TraceParameter(trace, kingDanger, sign);
+		}
+		middlegame += sign * (mobilityMiddlegame + danger);
+		endgame += sign * mobilityEndgame;
+	}
+}
+
+void EvalBoard::EvaluatePawns(PawnTable::Entry& entry, EvalTrace* trace) const
+{
+	entry.pawns[0] = 0;
+	entry.pawns[1] = 0;
+	for (int i = 0; i < 64; i++)
+	{
+		if (pieces[i].GetType() == PAWN)
+		{
+			entry.pawns[pieces[i].GetTeam() == PieceTeam::WHITE ? 0 : 1] |= 1ull << i;
+		}
+	}
+
+	entry.middlegame = 0;
+	entry.endgame = 0;
+	for (int side = 0; side < 2; side++)
+	{
+		PieceTeam team = side == 0 ? PieceTeam::WHITE : PieceTeam::BLACK;
+		PieceTeam enemyTeam = side == 0 ? PieceTeam::BLACK : PieceTeam::WHITE;
+		int sign = side == 0 ? 1 : -1;
+		uint64_t own = entry.pawns[side];
+		uint64_t enemy = entry.pawns[side ^ 1];
+		int middlegame = 0;
+		int endgame = 0;
+
+		entry.passed[side] = 0;
+		entry.attacks[side] = 0;
+		entry.attackSpans[side] = 0;
+		for (uint64_t mask = own; mask; mask &= mask - 1)
+		{
+			int tile = std::countr_zero(mask);
+			int file = tile % 8;
+			int rank = team == PieceTeam::WHITE ? 7 - tile / 8 : tile / 8;
+			int stopTile = team == PieceTeam::WHITE ? tile - 8 : tile + 8;
+
+			// the tiles a pawn attacks are those an enemy pawn on its tile would be attacked from
+			entry.attacks[side] |= pawnAttackerMasks[(int)enemyTeam][tile];
+			entry.attackSpans[side] |= pawnAttackSpans[(int)team][tile];
+
+			if (own & pawnFrontSpans[(int)team][tile])
+			{
+				middlegame += evalParams->doubledPawn[0];
+				endgame += evalParams->doubledPawn[1];
+				TraceParameters(trace, evalParams->doubledPawn, sign);
+			}
+
+			// backward: no pawn beside or behind it on the next files over can come up to defend it, and advancing
+			// runs into an enemy pawn's attack
+			uint64_t neighbours = own & adjacentFileMasks[file];
+			if (neighbours == 0)
+			{
+				middlegame += evalParams->isolatedPawn[0];
+				endgame += evalParams->isolatedPawn[1];
+				TraceParameters(trace, evalParams->isolatedPawn, sign);
+			}
+			else if ((neighbours & ~pawnAttackSpans[(int)team][tile]) == 0 && (enemy & pawnAttackerMasks[(int)enemyTeam][stopTile]))
+			{
+				middlegame += evalParams->backwardPawn[0];
+				endgame += evalParams->backwardPawn[1];
+				TraceParameters(trace, evalParams->backwardPawn, sign);
+			}
+
+			// only the front pawn of a doubled pair is passed
+			if (((enemy | own) & pawnFrontSpans[(int)team][tile]) == 0 && (enemy & pawnAttackSpans[(int)team][tile]) == 0)
+			{
+				entry.passed[side] |= 1ull << tile;
+				middlegame += evalParams->passedPawn[0][rank];
+				endgame += evalParams->passedPawn[1][rank];
+				TraceParameter(trace, evalParams->passedPawn[0][rank], sign);
+				TraceParameter(trace, evalParams->passedPawn[1][rank], sign);
+			}
+		}
+
+		entry.middlegame += side == 0 ? middlegame : -middlegame;
+		entry.endgame += side == 0 ? endgame : -endgame;
+	}
+}
+
+void EvalBoard::UpdateEvalScores(PieceTeam team, PieceType type, int tile, int sign)
+{
+	if (type >= EN_PASSANT)
+	{
+		return;
+	}
+
+	int square = team == PieceTeam::WHITE ? tile : tile ^ 56;
+	int perspective = team == PieceTeam::WHITE ? sign : -sign;
+	evalScores.middlegame += perspective * (evalParams->middlegameValues[type] + evalParams->middlegameTables[type][square]);
+	evalScores.endgame += perspective * (evalParams->endgameValues[type] + evalParams->endgameTables[type][square]);
+	if (sign > 0)
+	{
+		evalScores.materialKey += MaterialTable::PieceKey(team, type);
+	}
+	else
+	{
+		evalScores.materialKey -= MaterialTable::PieceKey(team, type);
+	}
+	evalScores.pieceKey ^= zobristPieces[(int)team][type][tile];
+
+	if (type == PAWN)
+	{
+		evalScores.pawnKey ^= zobristPieces[(int)team][PAWN][tile];
+	}
+	else if (type == KING)
+	{
+		// a king taken during search leaves the same placeholder a full recount would
+		evalScores.kingTiles[team == PieceTeam::WHITE ? 0 : 1] = sign > 0 ? tile : 0;
+	}
+
+	if (evalMode == EvalMode::NNUE)
+	{
+		if (sign > 0)
+		{
+			network->AddPiece(accumulator, team, type, tile);
+		}
+		else
+		{
+			network->RemovePiece(accumulator, team, type, tile);
+		}
+	}
+}
+
+void EvalBoard::RefreshAccumulator(PieceTeam perspective)
+{
+	int kingTile = 0;
+	for (int i = 0; i < 64; i++)
+	{
+		if (pieces[i].GetType() == KING && pieces[i].GetTeam() == perspective)
+		{
+			kingTile = i;
+			break;
+		}
+	}
+
+	network->ResetAccumulator(accumulator, perspective, kingTile);
+	for (int i = 0; i < 64; i++)
+	{
+		if (pieces[i].GetType() < EN_PASSANT)
+		{
+			network->AddFeature(accumulator, perspective, pieces[i].GetTeam(), pieces[i].GetType(), i);
+		}
+	}
+}
+
+void EvalBoard::PrepEvaluation()
+{
+	evalScores = CalcEvalScores();
+
+	if (evalMode == EvalMode::NNUE)
+	{
+		RefreshAccumulator(PieceTeam::WHITE);
+		RefreshAccumulator(PieceTeam::BLACK);
+	}
+}
+
+bool EvalBoard::LoadNetwork(const std::string& path)
+{
+	StopEval();
+	worker.Wait();
+
+	std::shared_ptr<NnueNetwork> loaded = std::make_shared<NnueNetwork>();
+	if (!loaded->Load(path))
+	{
+		return false;
+	}
+
+	network = loaded;
+	ClearEvalCaches();
+	return true;
+}
+
+bool EvalBoard::LoadEvalParameters(const std::string& path)
+{
+	StopEval();
+	worker.Wait();
+
+	std::shared_ptr<WeightsFile> loaded = std::make_shared<WeightsFile>();
+	if (!loaded->Open(path, WeightsFile::Content::EVAL_PARAMETERS))
+	{
+		return false;
+	}
+
+	const EvalParameters* parameters = loaded->GetSection<EvalParameters>(EvalParameters::SECTION_ID, 1);
+	if (parameters == nullptr)
+	{
+		printf("Weights file %s has no evaluation parameters of the expected size\n", path.c_str());
+		return false;
+	}
+
+	evalFile = loaded;
+	evalParams = parameters;
+
+	ClearEvalCaches();
+	return true;
+}
+
+void EvalBoard::SetEvalMode(EvalMode mode)
+{
+	StopEval();
+	worker.Wait();
+
+	if (mode == EvalMode::NNUE && !network)
+	{
+		printf("No network loaded, evaluating with piece-square tables\n");
+		mode = EvalMode::TABLES;
+	}
+
+	if (mode != evalMode)
+	{
+		evalMode = mode;
+		ClearEvalCaches();
+	}
+}
+
+void EvalBoard::ClearEvalCaches()
+{
+	// everything cached was worked out with the old parameters or network
+	evalCache.Clear();
+	pawnTable.Clear();
+	materialTable.Clear();
+	for (EvalBoard* helper : helpers)
+	{
+		helper->evalCache.Clear();
+		helper->pawnTable.Clear();
+		helper->materialTable.Clear();
+	}
+}
+
+bool EvalBoard::MakeMove(int startTile, int endTile)
+{
+	PieceTeam team = pieces[startTile].GetTeam();
+	PieceType type = pieces[startTile].GetType();
+	PieceTeam capturedTeam = pieces[endTile].GetTeam();
+	PieceType capturedType = pieces[endTile].GetType();
+	int capturedTile = endTile;
+
+	// a pawn moving onto an en passant tile takes the pawn that created it
+	if (type == PAWN && capturedType == EN_PASSANT && InMapRange(enPassantOwner))
+	{
+		capturedTile = enPassantOwner;
+		capturedTeam = pieces[capturedTile].GetTeam();
+		capturedType = pieces[capturedTile].GetType();
+	}
+
+	// nothing becomes unmoved again, so the pieces which stop counting are the one moving and the one taken
+	uint64_t unmovedLost = 0;
+	if (!pieces[startTile].bMoved && (type == KING || type == ROOK || type == PAWN))
+	{
+		unmovedLost ^= zobristUnmoved[startTile];
+	}
+	if (!pieces[capturedTile].bMoved && (capturedType == KING || capturedType == ROOK || capturedType == PAWN))
+	{
+		unmovedLost ^= zobristUnmoved[capturedTile];
+	}
+
+	if (!MovePiece(startTile, endTile))
+	{
+		return false;
+	}
+
+	// the move clears any older en passant tile and leaves one of its own after a double pawn push
+	evalScores.unmovedKey ^= unmovedLost;
+	evalScores.enPassantKey = type == PAWN && std::abs(endTile - startTile) == 16 ? zobristPieces[(int)team][EN_PASSANT][(startTile + endTile) / 2] : 0;
+
+	// the piece on endTile afterwards is the promoted one when the move promotes
+	UpdateEvalScores(team, type, startTile, -1);
+	UpdateEvalScores(team, pieces[endTile].GetType(), endTile, 1);
+	UpdateEvalScores(capturedTeam, capturedType, capturedTile, -1);
+
+	if (type == KING && startTile - 2 == endTile)
+	{
+		UpdateEvalScores(team, ROOK, startTile - 4, -1);
+		UpdateEvalScores(team, ROOK, startTile - 1, 1);
+		evalScores.unmovedKey ^= zobristUnmoved[startTile - 4];
+	}
+	else if (type == KING && startTile + 2 == endTile)
+	{
+		UpdateEvalScores(team, ROOK, startTile + 3, -1);
+		UpdateEvalScores(team, ROOK, startTile + 1, 1);
+		evalScores.unmovedKey ^= zobristUnmoved[startTile + 3];
+	}
+
+	// the king's own perspective is indexed by its tile, so every feature of it changes
+	if (evalMode == EvalMode::NNUE && type == KING)
+	{
+		RefreshAccumulator(team);
+	}
+
+	return true;
+}
+
+void EvalBoard::HandleEval()
+{
+	return;
+}
+
+void EvalBoard::UndoMove(const SearchFrame& frame)
+{
+	// undo move by restoring board state
+	RecoverBoardState(frame.boardState);
+	if (evalMode == EvalMode::NNUE)
+	{
+		accumulator = frame.accumulator;
+	}
+	if (currentTurn == PieceTeam::WHITE)
+	{
+		checkingPiecesBlack = frame.checkingPieces;
+	}
+	else
+	{
+		checkingPiecesWhite = frame.checkingPieces;
+	}
+
+	// restore attackMap, recovering from cache rather than calculating again.
+	// Assigning into vectors which already have the capacity copies without allocating
+	if (currentTurn == PieceTeam::WHITE)
+	{
+		std::copy(std::begin(frame.attackMap), std::end(frame.attackMap), std::begin(attackMapWhite));
+		std::copy(std::begin(frame.opponentAttackMap), std::end(frame.opponentAttackMap), std::begin(attackMapBlack));
+	}
+	else
+	{
+		std::copy(std::begin(frame.attackMap), std::end(frame.attackMap), std::begin(attackMapBlack));
+		std::copy(std::begin(frame.opponentAttackMap), std::end(frame.opponentAttackMap), std::begin(attackMapWhite));
+	}
+}
+
+void EvalBoard::PrepSearchStack()
+{
+	// no piece has more than 27 moves and no position more than 218, so nothing reserved here ever has to grow
+	searchStack = std::make_unique<SearchFrame[]>(MAX_PLY);
+	for (int ply = 0; ply < MAX_PLY; ply++)
+	{
+		SearchFrame& frame = searchStack[ply];
+		for (std::vector<int>& tileMoves : frame.attackMap)
+		{
+			tileMoves.reserve(32);
+		}
+		for (std::vector<int>& tileMoves : frame.opponentAttackMap)
+		{
+			tileMoves.reserve(32);
+		}
+		frame.checkingPieces.reserve(16);
+		frame.moves.reserve(256);
+		frame.quietsTried.reserve(256);
+		frame.bestMoves.reserve(256);
+		frame.staticEval = 0;
+		frame.pvLength = 0;
+	}
+}
+
+void EvalBoard::SaveFrame(SearchFrame& frame)
+{
+	frame.boardState.Capture(this);
+	if (evalMode == EvalMode::NNUE)
+	{
+		frame.accumulator = accumulator;
+	}
+
+	if (currentTurn == PieceTeam::WHITE)
+	{
+		std::copy(std::begin(attackMapWhite), std::end(attackMapWhite), std::begin(frame.attackMap));
+		std::copy(std::begin(attackMapBlack), std::end(attackMapBlack), std::begin(frame.opponentAttackMap));
+	}
+	else
+	{
+		std::copy(std::begin(attackMapBlack), std::end(attackMapBlack), std::begin(frame.attackMap));
+		std::copy(std::begin(attackMapWhite), std::end(attackMapWhite), std::begin(frame.opponentAttackMap));
+	}
+
+	frame.checkingPieces = currentTurn == PieceTeam::WHITE ? checkingPiecesBlack : checkingPiecesWhite;
+	frame.moves.clear();
+	frame.quietsTried.clear();
+	frame.bestMoves.clear();
+	frame.pvLength = 0;
+}
+
+void EvalBoard::UpdatePV(const int ply, const Move& move)
+{
+	// this ply's line is the move just searched followed by the line it was answered with
+	SearchFrame& frame = searchStack[ply];
+	frame.pv[0] = move;
+	frame.pvKeys[0] = frame.hashKey;
+	frame.pvLength = 1;
+
+	if (ply + 1 < MAX_PLY)
+	{
+		const SearchFrame& child = searchStack[ply + 1];
+		for (int i = 0; i < child.pvLength && frame.pvLength < MAX_PLY; i++)
+		{
+			frame.pv[frame.pvLength] = child.pv[i];
+			frame.pvKeys[frame.pvLength] = child.pvKeys[i];
+			frame.pvLength++;
+		}
+	}
+}
+
+int EvalBoard::Search(const int ply, const int depth, int alpha, int beta, bool bAllowNullMove, const Move& excludedMove)
+{
+	// everything a node uses is preallocated in its frame and the board, so the search never touches the heap
+	NoAllocationScope noAllocations;
+
+	if (ply >= MAX_PLY)
+	{
+		return StaticEval();
+	}
+	searchStack[ply].pvLength = 0;
+
+	if (bGameOver)
+	{
+		// checkmate or stalemate was found when the previous move was played
+		bool bInCheck = currentTurn == PieceTeam::WHITE ? bInCheckWhite : bInCheckBlack;
+		return bInCheck ? MatedEval(ply) : 0;
+	}
+
+	if (ply > depth)
+	{
+		return SearchAllCaptures(ply, alpha, beta);
+	}
+
+	nodes++;
+
+	if (searchControl.ShouldStop())
+	{
+		bEarlyExit = true;
+		return -1;
+	}
+
+	// mate distance pruning: nothing here can beat mating on the next ply or be worse than being mated on this one,
+	// so once a shorter mate is known elsewhere the window closes and the node is cut
+	if (ply > 1)
+	{
+		alpha = std::max(alpha, MatedEval(ply));
+		beta = std::min(beta, -MatedEval(ply + 1));
+		if (alpha >= beta)
+		{
+			return alpha;
+		}
+	}
+
+	bool bPVNode = beta - alpha > 1;
+	bool bExcluding = InMapRange(excludedMove.startTile);
+	// only the main search chooses the move, a helper's root is searched like any other node
+	bool bMainRoot = ply == 1 && !bHelper;
+	int remainingDepth = depth - ply + 1;
+
+	uint64_t hashKey = HashKey();
+#ifdef TESTING
+	assert(hashKey == ComputeHash());
+#endif
+	Move hashMove;
+	TranspositionTable::Entry hashEntry;
+	bool bHashFound = transpositionTable->Probe(hashKey, hashEntry);
+	int hashEval = 0;
+	if (bHashFound)
+	{
+		hashMove = Move(hashEntry.startTile, hashEntry.endTile);
+		hashEval = EvalFromTable(hashEntry.eval, ply);
+
+		if (ply > 1 && !bPVNode && !bExcluding && hashEntry.depth >= remainingDepth)
+		{
+			if (hashEntry.bound == TranspositionTable::Bound::EXACT ||
+				(hashEntry.bound == TranspositionTable::Bound::LOWER && hashEval >= beta) ||
+				(hashEntry.bound == TranspositionTable::Bound::UPPER && hashEval <= alpha))
+			{
+				return hashEval;
+			}
+		}
+	}
+
+	int eval = 0;
+	int bestEval = -INFINITE_EVAL;
+	bool bMoveFound = false;
+
+	Move bestMove;
+
+	// save current board state (locations, whether piece moved for castling etc)
+	SearchFrame& frame = searchStack[ply];
+	SaveFrame(frame);
+	frame.hashKey = hashKey;
+	frame.staticEval = StaticEval();
+
+	bool bInCheck = currentTurn == PieceTeam::WHITE ? bInCheckWhite : bInCheckBlack;
+	bool bCanPrune = ply > 1 && !bPVNode && !bInCheck && !bExcluding;
+
+	// reverse futility: so far above beta that even losing the margin for every ply left keeps it there
+	if (bCanPrune && remainingDepth <= pruning.reverseFutilityDepth && beta < MATE_BOUND &&
+		frame.staticEval - pruning.reverseFutility * remainingDepth >= beta)
+	{
+		return frame.staticEval;
+	}
+
+	// razoring: so far below alpha that only captures could help, so let quiescence decide
+	if (bCanPrune && remainingDepth <= pruning.razoringDepth && alpha > -MATE_BOUND &&
+		frame.staticEval + pruning.razoring * remainingDepth < alpha)
+	{
+		// quiescence runs on this ply's frame and leaves its own eval there, which can be a lazy one for its window
+		int staticEval = frame.staticEval;
+		int captureEval = SearchAllCaptures(ply, alpha - 1, alpha);
+		frame.staticEval = staticEval;
+		if (bEarlyExit)
+		{
+			return -1;
+		}
+
+		if (captureEval < alpha)
+		{
+			return captureEval;
+		}
+	}
+
+	// give the opponent a free move, if they still can't get back below beta the position is good enough to cut.
+	// PV nodes need an exact eval rather than a bound, so they are always searched in full
+	if (bAllowNullMove && ply > 1 && !bPVNode && !bInCheck && !bExcluding && remainingDepth > NULL_MOVE_REDUCTION && HasNonPawnMaterial(currentTurn) &&
+		frame.staticEval >= beta)
+	{
+		int reduction = NULL_MOVE_REDUCTION + remainingDepth / 4;
+
+		MakeNullMove();
+		int nullEval = -Search(ply + 1, depth - reduction, -beta, -beta + 1, false);
+		UndoMove(frame);
+
+		if (bEarlyExit)
+		{
+			return -1;
+		}
+
+		if (nullEval >= beta)
+		{
+			// a mate found after passing is not proven for the real position
+			if (nullEval >= MATE_BOUND)
+			{
+				nullEval = beta;
+			}
+
+			if (remainingDepth < NULL_MOVE_VERIFY_DEPTH)
+			{
+				return nullEval;
+			}
+
+			int verifyEval = Search(ply, depth - reduction, beta - 1, beta, false);
+			UndoMove(frame);
+
+			if (bEarlyExit)
+			{
+				return -1;
+			}
+
+			if (verifyEval >= beta)
+			{
+				return nullEval;
+			}
+		}
+	}
+
+	// singular extension: if every other move falls well short of the hash move's eval, the hash move is the only one
+	// keeping the position and is searched a ply deeper. Checked before this node's moves are generated, as the
+	// exclusion search shares its frame
+	bool bSingular = false;
+	if (ply > 1 && !bExcluding && depth < extensionLimit && remainingDepth >= SINGULAR_EXTENSION_DEPTH && bHashFound &&
+		InMapRange(hashMove.startTile) && hashEntry.depth >= remainingDepth - 3 && std::abs(hashEval) < MATE_BOUND &&
+		(hashEntry.bound == TranspositionTable::Bound::LOWER || hashEntry.bound == TranspositionTable::Bound::EXACT))
+	{
+		int singularBeta = hashEval - SINGULAR_MARGIN;
+		int singularEval = Search(ply, ply - 1 + remainingDepth / 2, singularBeta - 1, singularBeta, false, hashMove);
+		UndoMove(frame);
+
+		if (bEarlyExit)
+		{
+			return -1;
+		}
+
+		bSingular = singularEval < singularBeta;
+	}
+
+	// searches run above at this same ply, like the null move verification and the singular exclusion search, share
+	// this frame and leave their own move lists and PV in it
+	frame.moves.clear();
+	frame.quietsTried.clear();
+	frame.pvLength = 0;
+	GenerateMoves(frame.attackMap, frame.moves, false);
+#ifdef TESTING
+	// a move listed twice would be searched twice and counted twice by the pruning that goes by move number
+	for (size_t i = 0; i < frame.moves.size(); i++)
+	{
+		assert(std::find(frame.moves.begin(), frame.moves.begin() + i, frame.moves[i]) == frame.moves.begin() + i);
+	}
+#endif
+	OrderMoves(frame.moves, ply, hashMove);
+
+	int moveNumber = 0;
+	int originalAlpha = alpha;
+
+	// quiet moves can't lift a position this far below alpha, and late ones at low depth are unlikely to be best
+	bool bFutile = bCanPrune && remainingDepth <= pruning.futilityDepth && alpha > -MATE_BOUND &&
+		frame.staticEval + pruning.futility * remainingDepth <= alpha;
+	int lateMoveLimit = remainingDepth <= pruning.lateMovePruningDepth ? pruning.lateMovePruningBase + remainingDepth * remainingDepth : INT_MAX;
+
+	for (const Move& move : frame.moves)
+	{
+		if (ply == 1 && !rootExcluded.empty() && std::find(rootExcluded.begin(), rootExcluded.end(), move) != rootExcluded.end())
+		{
+			continue;
+		}
+
+		if (bExcluding && move == excludedMove)
+		{
+			continue;
+		}
+
+		bool bCapture = IsCapture(move.startTile, move.endTile);
+		bool bQuiet = !bCapture && !IsPromotion(move.startTile, move.endTile);
+
+		// pruned before the move is played, which is most of what a frontier node costs. Once one move has been searched
+		// the node has a real eval to return, and mate or stalemate can no longer be mistaken
+		if (bCanPrune && bQuiet && moveNumber > 0 && (bFutile || moveNumber >= lateMoveLimit))
+		{
+			continue;
+		}
+
+		// play move, moves that turn out to be illegal leave the board untouched
+		if (!MakeMove(move.startTile, move.endTile))
+		{
+			continue;
+		}
+		bMoveFound = true;
+		moveNumber++;
+
+		bool bGivesCheck = currentTurn == PieceTeam::WHITE ? bInCheckWhite : bInCheckBlack;
+
+		int extension = 0;
+		if (depth < extensionLimit)
+		{
+			if (bGivesCheck || (bSingular && move == hashMove) ||
+				(bPVNode && bCapture && ply > 1 && searchStack[ply - 1].captureTile == move.endTile))
+			{
+				extension = 1;
+			}
+		}
+		int childDepth = depth + extension;
+		frame.captureTile = bCapture ? move.endTile : -1;
+
+		int reduction = 0;
+		if (ply > 1 && bQuiet && !bInCheck && !bGivesCheck && remainingDepth >= 3 && moveNumber > 3)
+		{
+			reduction = lateMoveReductions[std::min(remainingDepth, MAX_PLY - 1)][std::min(moveNumber, 63)];
+
+			// moves which have caused cutoffs elsewhere are reduced less, moves which never have are reduced more
+			PieceTeam mover = currentTurn == PieceTeam::WHITE ? PieceTeam::BLACK : PieceTeam::WHITE;
+			reduction -= history[(int)mover][move.startTile][move.endTile] / (HISTORY_MAX / 2);
+
+			if (bPVNode || move == killerMoves[ply][0] || move == killerMoves[ply][1])
+			{
+				reduction--;
+			}
+
+			reduction = std::clamp(reduction, 0, remainingDepth - 2);
+		}
+
+		// at the root, search one below the best eval so that moves tying with it still return an exact eval
+		int searchAlpha = ply == 1 ? alpha - 1 : alpha;
+
+		// principal variation search: only the first move gets the full window, the rest are probed with a null window
+		// to prove they are no better, and are searched again with the full window if the probe fails high
+		if (moveNumber == 1)
+		{
+			eval = -Search(ply + 1, childDepth, -beta, -searchAlpha);
+		}
+		else
+		{
+			eval = -Search(ply + 1, childDepth - reduction, -searchAlpha - 1, -searchAlpha);
+
+			if (eval > searchAlpha && reduction > 0)
+			{
+				eval = -Search(ply + 1, childDepth, -searchAlpha - 1, -searchAlpha);
+			}
+
+			if (eval > searchAlpha && eval < beta)
+			{
+				eval = -Search(ply + 1, childDepth, -beta, -searchAlpha);
+			}
+		}
+
+		UndoMove(frame);
+
+		// a cancelled search returns before its eval can reach the best moves, history or the transposition table
+		if (bEarlyExit)
+		{
+			return -1;
+		}
+
+		if (eval > bestEval && bMainRoot)
+		{
+			bestEval = eval;
+			bestMove = move;
+			frame.bestMoves.clear();
+			frame.bestMoves.emplace(frame.bestMoves.end(), move.startTile, move.endTile);
+			UpdatePV(ply, move);
+		}
+		else if (eval == bestEval && bMainRoot)
+		{
+			frame.bestMoves.emplace(frame.bestMoves.end(), move.startTile, move.endTile);
+		}
+		else if (eval > bestEval)
+		{
+			bestEval = eval;
+			bestMove = move;
+			UpdatePV(ply, move);
+		}
+
+		if (eval > alpha)
+		{
+			alpha = eval;
+		}
+
+		if (alpha >= beta)
+		{
+			if (bQuiet)
+			{
+				UpdateQuietMoveOrdering(ply, depth, move, frame.quietsTried);
+			}
+			break;
+		}
+
+		if (bQuiet)
+		{
+			frame.quietsTried.push_back(move);
+		}
+	}
+
+	if (!bMoveFound)
+	{
+		// the excluded move is the only legal one, which makes it as singular as a move can be
+		if (bExcluding)
+		{
+			return alpha;
+		}
+
+		if ((currentTurn == PieceTeam::WHITE && bInCheckWhite) || (currentTurn == PieceTeam::BLACK && bInCheckBlack))
+		{
+			return MatedEval(ply); // nothing is worse than checkmate, and the later it comes the better
+		}
+		else
+		{
+			return 0; // stalemate
+		}
+	}
+
+	TranspositionTable::Bound bound = TranspositionTable::Bound::EXACT;
+	if (bestEval <= originalAlpha)
+	{
+		bound = TranspositionTable::Bound::UPPER;
+	}
+	else if (bestEval >= beta)
+	{
+		bound = TranspositionTable::Bound::LOWER;
+	}
+	// a root search with moves left out hasn't found the best move of the position
+	if ((ply > 1 || multiPVIndex == 0) && !bExcluding)
+	{
+		transpositionTable->Store(hashKey, EvalToTable(bestEval, ply), remainingDepth, bestMove.startTile, bestMove.endTile, bound);
+	}
+
+	// when the root fails low every move is only known to be below alpha, so keep the best moves from before.
+	// Lines after the first are only for analysis and never change the move played
+	if (bMainRoot && bestEval > originalAlpha && multiPVIndex == 0)
+	{
+		SetBestMoves(frame.bestMoves);
+
+		// a tie broken in favour of a different move than the PV was built from leaves the expected reply unknown
+		if (!(frame.pv[0] == Move(bestMoveStart, bestMoveEnd)))
+		{
+			frame.pv[0] = Move(bestMoveStart, bestMoveEnd);
+			frame.pvLength = 1;
+		}
+	}
+
+	return bestEval;
+}
+
+int EvalBoard::SearchAllCaptures(const int ply, int alpha, int beta)
+{
+	NoAllocationScope noAllocations;
+
+	if (ply >= MAX_PLY)
+	{
+		return StaticEval();
+	}
+
+	bool bInCheck = currentTurn == PieceTeam::WHITE ? bInCheckWhite : bInCheckBlack;
+
+	if (bGameOver)
+	{
+		return bInCheck ? MatedEval(ply) : 0;
+	}
+
+	nodes++;
+
+	if (searchControl.ShouldStop())
+	{
+		bEarlyExit = true;
+		return -1;
+	}
+
+	int eval = 0;
+	int bestEval = MatedEval(ply);
+	bool bMoveFound = false;
+
+	// when in check every evasion has to be looked at, otherwise the side to move can stand pat and stop capturing
+	if (!bInCheck)
+	{
+		// quiescence nodes only compare the eval to the window, so it can be lazy
+		bestEval = StaticEval(alpha, beta);
+		if (bestEval >= beta)
+		{
+			return bestEval;
+		}
+
+		if (bestEval > alpha)
+		{
+			alpha = bestEval;
+		}
+	}
+
+	// save current board state (locations, whether piece moved for castling etc)
+	SearchFrame& frame = searchStack[ply];
+	SaveFrame(frame);
+	frame.staticEval = bestEval;
+
+	GenerateMoves(frame.attackMap, frame.moves, !bInCheck);
+	OrderMoves(frame.moves, MAX_PLY - 1, Move());
+
+	for (const Move& move : frame.moves)
+	{
+		// captures are ordered by SEE, so once a losing capture is reached the rest are losing too
+		if (!bInCheck && move.score < 0)
+		{
+			break;
+		}
+
+		if (!MakeMove(move.startTile, move.endTile))
+		{
+			continue;
+		}
+		bMoveFound = true;
+
+		eval = -SearchAllCaptures(ply + 1, -beta, -alpha);
+
+		UndoMove(frame);
+
+		if (bEarlyExit)
+		{
+			return -1;
+		}
+
+		if (eval > bestEval)
+		{
+			bestEval = eval;
+		}
+
+		if (eval > alpha)
+		{
+			alpha = eval;
+		}
+
+		if (alpha >= beta)
+		{
+			break;
+		}
+	}
+
+	if (bInCheck && !bMoveFound)
+	{
+		return MatedEval(ply);
+	}
+
+	return bestEval;
+}
+
+void EvalBoard::MakeNullMove()
+{
+	// passing only flips the side to move and removes any en passant square, the opponent's moves still have to be generated
+	lastEnPassantIndex = -1;
+	ClearEnPassant();
+	ClearPinnedPieces();
+	evalScores.enPassantKey = 0;
+
+	secondLastMoveStart = lastMoveStart;
+	secondLastMoveEnd = lastMoveEnd;
+	lastMoveStart = -1;
+	lastMoveEnd = -1;
+
+	currentTurn = currentTurn == PieceTeam::WHITE ? PieceTeam::BLACK : PieceTeam::WHITE;
+	CalculateMoves();
+}
+
+void EvalBoard::PrepReductions()
+{
+	for (int depth = 0; depth < MAX_PLY; depth++)
+	{
+		for (int moveNumber = 0; moveNumber < 64; moveNumber++)
+		{
+			if (depth == 0 || moveNumber == 0)
+			{
+				lateMoveReductions[depth][moveNumber] = 0;
+				continue;
+			}
+
+			lateMoveReductions[depth][moveNumber] = (int)(0.75 + std::log(depth) * std::log(moveNumber) / 2.25);
+		}
+	}
+}
+
+void EvalBoard::PrepZobristKeys()
+{
+	// fixed seed so that every thread hashes a position to the same key
+	std::mt19937_64 generator(0x4D7943686573734Bull);
+
+	for (int team = 0; team < 3; team++)
+	{
+		for (int type = 0; type < 8; type++)
+		{
+			for (int tile = 0; tile < 64; tile++)
+			{
+				zobristPieces[team][type][tile] = generator();
+			}
+		}
+	}
+
+	for (int tile = 0; tile < 64; tile++)
+	{
+		zobristUnmoved[tile] = generator();
+	}
+
+	zobristBlackToMove = generator();
+}
+
+uint64_t EvalBoard::ComputeHash() const
+{
+	uint64_t key = 0;
+
+	for (int i = 0; i < 64; i++)
+	{
+		if (!IsActivePiece(i))
+			continue;
+
+		PieceType type = pieces[i].GetType();
+		key ^= zobristPieces[(int)pieces[i].GetTeam()][type][i];
+
+		if (!pieces[i].bMoved && (type == KING || type == ROOK || type == PAWN))
+		{
+			key ^= zobristUnmoved[i];
+		}
+	}
+
+	if (currentTurn == PieceTeam::BLACK)
+	{
+		key ^= zobristBlackToMove;
+	}
+
+	return key;
+}
+
+uint64_t EvalBoard::HashKey() const
+{
+	uint64_t key = evalScores.pieceKey ^ evalScores.unmovedKey ^ evalScores.enPassantKey;
+	return currentTurn == PieceTeam::BLACK ? key ^ zobristBlackToMove : key;
+}
+
+bool EvalBoard::HasNonPawnMaterial(PieceTeam team) const
+{
+	for (int i = 0; i < 64; i++)
+	{
+		if (pieces[i].GetTeam() != team)
+			continue;
+
+		PieceType type = pieces[i].GetType();
+		if (type == QUEEN || type == ROOK || type == BISHOP || type == KNIGHT)
+			return true;
+	}
+	return false;
+}
+
+bool EvalBoard::IsCapture(int startTile, int endTile) const
+{
+	if (!IsActivePiece(endTile) || pieces[endTile].GetTeam() == pieces[startTile].GetTeam())
+	{
+		return false;
+	}
+
+	// only pawns can take the en passant piece, anything else simply moves onto that tile
+	return pieces[endTile].GetType() != EN_PASSANT || pieces[startTile].GetType() == PAWN;
+}
+
+bool EvalBoard::IsPromotion(int startTile, int endTile) const
+{
+	return pieces[startTile].GetType() == PAWN && (endTile < 8 || endTile >= 56);
+}
+
+void EvalBoard::GenerateMoves(const std::vector<int> (&attackMap)[64], std::vector<Move>& moves, bool bCapturesOnly) const
+{
+	for (size_t startTile = 0; startTile < 64; startTile++)
+	{
+		if (!IsActivePiece(startTile) || pieces[startTile].GetTeam() != currentTurn || attackMap[startTile].empty())
+			continue;
+
+		for (int move : attackMap[startTile])
+		{
+			if (bCapturesOnly && !IsCapture(startTile, move))
+				continue;
+
+			moves.emplace_back(startTile, move);
+		}
 	}
+}
 
-	return bestEval;
+void EvalBoard::OrderMoves(std::vector<Move>& moves, const int ply, const Move& hashMove) const
+{
+	Move counterMove;
+	if (InMapRange(lastMoveStart) && InMapRange(lastMoveEnd))
+	{
+		counterMove = counterMoves[lastMoveStart][lastMoveEnd];
+	}
+
+	// the best move from the transposition table first, then winning and equal captures, then killers,
+	// the countermove and the remaining quiet moves by history, then captures which lose material
+	for (Move& move : moves)
+	{
+		if (move == hashMove)
+		{
+			move.score = 2000000;
+		}
+		else if (IsCapture(move.startTile, move.endTile))
+		{
+			int see = StaticExchangeEval(move.startTile, move.endTile);
+			move.score = see >= 0 ? 1000000 + see * 10 - pieces[move.startTile].GetValue() : -1000000 + see;
+		}
+		else if (move == killerMoves[ply][0])
+		{
+			move.score = 900000;
+		}
+		else if (move == killerMoves[ply][1])
+		{
+			move.score = 800000;
+		}
+		else if (move == counterMove)
+		{
+			move.score = 700000;
+		}
+		else
+		{
+			move.score = history[(int)currentTurn][move.startTile][move.endTile];
+		}
+	}
+
+	SortMoves(moves);
+}
+
+void EvalBoard::SortMoves(std::vector<Move>& moves)
+{
+	// stable insertion sort, std::stable_sort would allocate a buffer on every call and move lists are short
+	for (size_t i = 1; i < moves.size(); i++)
+	{
+		Move move = moves[i];
+		size_t j = i;
+		while (j > 0 && moves[j - 1].score < move.score)
+		{
+			moves[j] = moves[j - 1];
+			j--;
+		}
+		moves[j] = move;
+	}
+}
+
+void EvalBoard::ClearMoveOrdering()
+{
+	for (int ply = 0; ply < MAX_PLY; ply++)
+	{
+		killerMoves[ply][0] = Move();
+		killerMoves[ply][1] = Move();
+	}
+
+	for (int start = 0; start < 64; start++)
+	{
+		for (int end = 0; end < 64; end++)
+		{
+			history[(int)PieceTeam::NONE][start][end] = 0;
+			history[(int)PieceTeam::WHITE][start][end] = 0;
+			history[(int)PieceTeam::BLACK][start][end] = 0;
+			counterMoves[start][end] = Move();
+		}
+	}
+}
+
+void EvalBoard::AgeMoveOrdering()
+{
+	// killers are indexed by ply from the root, which no longer lines up once the game has moved on
+	for (int ply = 0; ply < MAX_PLY; ply++)
+	{
+		killerMoves[ply][0] = Move();
+		killerMoves[ply][1] = Move();
+	}
+
+	// history from earlier moves still says which moves tend to be good here, but should give way to this search
+	for (int team = 0; team < 3; team++)
+	{
+		for (int start = 0; start < 64; start++)
+		{
+			for (int end = 0; end < 64; end++)
+			{
+				history[team][start][end] /= 2;
+			}
+		}
+	}
+}
+
+void EvalBoard::UpdateHistory(PieceTeam team, const Move& move, int bonus)
+{
+	// gravity: the closer an entry gets to HISTORY_MAX the smaller the change, so scores stay bounded and old results fade
+	int& entry = history[(int)team][move.startTile][move.endTile];
+	entry += bonus - entry * std::abs(bonus) / HISTORY_MAX;
+}
+
+void EvalBoard::UpdateQuietMoveOrdering(const int ply, const int depth, const Move& move, const std::vector<Move>& quietsTried)
+{
+	if (!(move == killerMoves[ply][0]))
+	{
+		killerMoves[ply][1] = killerMoves[ply][0];
+		killerMoves[ply][0] = move;
+	}
+
+	// lastMoveStart and lastMoveEnd hold the move which led to this position once the cutoff move has been undone
+	if (InMapRange(lastMoveStart) && InMapRange(lastMoveEnd))
+	{
+		counterMoves[lastMoveStart][lastMoveEnd] = move;
+	}
+
+	int remainingDepth = depth - ply + 1;
+	int bonus = std::min(remainingDepth * remainingDepth * 32, HISTORY_MAX);
+
+	UpdateHistory(currentTurn, move, bonus);
+	for (const Move& quiet : quietsTried)
+	{
+		UpdateHistory(currentTurn, quiet, -bonus);
+	}
+}
+
+// ========================================== STATIC EXCHANGE ==========================================
+
+void EvalBoard::PrepAttackMasks()
+{
+	const int knightOffsets[8][2] = { { 1, 2 }, { 2, 1 }, { 2, -1 }, { 1, -2 }, { -1, -2 }, { -2, -1 }, { -2, 1 }, { -1, 2 } };
+	// orthogonal directions first, then diagonals
+	const int rayOffsets[8][2] = { { 0, -1 }, { 0, 1 }, { -1, 0 }, { 1, 0 }, { -1, -1 }, { 1, -1 }, { -1, 1 }, { 1, 1 } };
+
+	for (int tile = 0; tile < 64; tile++)
+	{
+		int file = tile % 8;
+		int rank = tile / 8;
+
+		knightMasks[tile] = 0;
+		kingMasks[tile] = 0;
+		for (int team = 0; team < 3; team++)
+		{
+			pawnFrontSpans[team][tile] = 0;
+			pawnAttackSpans[team][tile] = 0;
+			pawnShieldMasks[team][tile] = 0;
+		}
+		pawnAttackerMasks[(int)PieceTeam::NONE][tile] = 0;
+		pawnAttackerMasks[(int)PieceTeam::WHITE][tile] = 0;
+		pawnAttackerMasks[(int)PieceTeam::BLACK][tile] = 0;
+
+		for (const int* offset : knightOffsets)
+		{
+			int x = file + offset[0];
+			int y = rank + offset[1];
+			if (0 <= x && x < 8 && 0 <= y && y < 8)
+			{
+				knightMasks[tile] |= 1ull << (y * 8 + x);
+			}
+		}
+
+		for (int dir = 0; dir < 8; dir++)
+		{
+			rayLengths[tile][dir] = 0;
+
+			int x = file + rayOffsets[dir][0];
+			int y = rank + rayOffsets[dir][1];
+			if (0 <= x && x < 8 && 0 <= y && y < 8)
+			{
+				kingMasks[tile] |= 1ull << (y * 8 + x);
+			}
+
+			while (0 <= x && x < 8 && 0 <= y && y < 8)
+			{
+				rays[tile][dir][rayLengths[tile][dir]++] = y * 8 + x;
+				x += rayOffsets[dir][0];
+				y += rayOffsets[dir][1];
+			}
+		}
+
+		// white pawns move towards tile 0, so a white pawn attacks this tile from the rank below it
+		for (int side : { -1, 1 })
+		{
+			int x = file + side;
+			if (x < 0 || x >= 8)
+				continue;
+
+			if (rank + 1 < 8)
+				pawnAttackerMasks[(int)PieceTeam::WHITE][tile] |= 1ull << ((rank + 1) * 8 + x);
+			if (rank - 1 >= 0)
+				pawnAttackerMasks[(int)PieceTeam::BLACK][tile] |= 1ull << ((rank - 1) * 8 + x);
+		}
+
+		// white's side of the board is the higher tiles, so everything ahead of white is on a lower rank index
+		for (int y = 0; y < 8; y++)
+		{
+			PieceTeam team = y < rank ? PieceTeam::WHITE : PieceTeam::BLACK;
+			if (y == rank)
+				continue;
+
+			pawnFrontSpans[(int)team][tile] |= 1ull << (y * 8 + file);
+			for (int x = std::max(file - 1, 0); x <= std::min(file + 1, 7); x++)
+			{
+				if (x != file)
+					pawnAttackSpans[(int)team][tile] |= 1ull << (y * 8 + x);
+				if (std::abs(y - rank) <= 2)
+					pawnShieldMasks[(int)team][tile] |= 1ull << (y * 8 + x);
+			}
+		}
+	}
+
+	for (int file = 0; file < 8; file++)
+	{
+		adjacentFileMasks[file] = 0;
+		for (int x : { file - 1, file + 1 })
+		{
+			if (0 <= x && x < 8)
+			{
+				for (int y = 0; y < 8; y++)
+				{
+					adjacentFileMasks[file] |= 1ull << (y * 8 + x);
+				}
+			}
+		}
+	}
+}
+
+uint64_t EvalBoard::GetOccupancy() const
+{
+	uint64_t occupancy = 0;
+	for (int i = 0; i < 64; i++)
+	{
+		if (IsActivePiece(i) && pieces[i].GetType() != EN_PASSANT)
+		{
+			occupancy |= 1ull << i;
+		}
+	}
+	return occupancy;
+}
+
+uint64_t EvalBoard::AttackersTo(int tile, uint64_t occupancy) const
+{
+	uint64_t attackers = 0;
+
+	for (uint64_t mask = knightMasks[tile] & occupancy; mask; mask &= mask - 1)
+	{
+		int from = std::countr_zero(mask);
+		if (pieces[from].GetType() == KNIGHT)
+			attackers |= 1ull << from;
+	}
+
+	for (uint64_t mask = kingMasks[tile] & occupancy; mask; mask &= mask - 1)
+	{
+		int from = std::countr_zero(mask);
+		if (pieces[from].GetType() == KING)
+			attackers |= 1ull << from;
+	}
+
+	for (PieceTeam team : { PieceTeam::WHITE, PieceTeam::BLACK })
+	{
+		for (uint64_t mask = pawnAttackerMasks[(int)team][tile] & occupancy; mask; mask &= mask - 1)
+		{
+			int from = std::countr_zero(mask);
+			if (pieces[from].GetType() == PAWN && pieces[from].GetTeam() == team)
+				attackers |= 1ull << from;
+		}
+	}
+
+	// the first piece along each ray is the only slider that can attack, pieces removed from occupancy reveal the ones behind them
+	for (int dir = 0; dir < 8; dir++)
+	{
+		PieceType slider = dir < 4 ? ROOK : BISHOP;
+		for (int i = 0; i < rayLengths[tile][dir]; i++)
+		{
+			int from = rays[tile][dir][i];
+			if (!(occupancy & (1ull << from)))
+				continue;
+
+			if (pieces[from].GetType() == slider || pieces[from].GetType() == QUEEN)
+				attackers |= 1ull << from;
+			break;
+		}
+	}
+
+	return attackers;
+}
+
+int EvalBoard::StaticExchangeEval(int startTile, int endTile) const
+{
+	const PieceType attackOrder[6] = { PAWN, KNIGHT, BISHOP, ROOK, QUEEN, KING };
+
+	int gain[32];
+	int d = 0;
+
+	uint64_t occupancy = GetOccupancy();
+	PieceTeam side = pieces[startTile].GetTeam();
+	PieceType attacker = pieces[startTile].GetType();
+
+	gain[0] = IsCapture(startTile, endTile) ? SeeValue(pieces[endTile].GetType()) : 0;
+	occupancy &= ~(1ull << startTile);
+
+	while (d < 31)
+	{
+		d++;
+		side = side == PieceTeam::WHITE ? PieceTeam::BLACK : PieceTeam::WHITE;
+
+		// value of the piece standing on endTile if the side to move takes it
+		gain[d] = SeeValue(attacker) - gain[d - 1];
+		if (std::max(-gain[d - 1], gain[d]) < 0)
+			break;
+
+		uint64_t attackers = AttackersTo(endTile, occupancy) & occupancy;
+		int from = -1;
+		for (PieceType type : attackOrder)
+		{
+			for (uint64_t mask = attackers; mask; mask &= mask - 1)
+			{
+				int tile = std::countr_zero(mask);
+				if (pieces[tile].GetTeam() == side && pieces[tile].GetType() == type)
+				{
+					from = tile;
+					break;
+				}
+			}
+
+			if (from != -1)
+				break;
+		}
+
+		if (from == -1)
+			break;
+
+		occupancy &= ~(1ull << from);
+		attacker = pieces[from].GetType();
+	}
+
+	while (--d)
+	{
+		gain[d - 1] = -std::max(-gain[d - 1], gain[d]);
+	}
+
+	return gain[0];
+}
+
+// the middlegame values of the parameters in use, with the king given a value higher than everything else combined so it
+// is only used to capture when nothing can take it back
+int EvalBoard::SeeValue(PieceType type) const
+{
+	switch (type)
+	{
+	case KING:
+		return 10000;
+	case EN_PASSANT:
+		return evalParams->middlegameValues[PAWN];
+	case NONE:
+		return 0;
+	default:
+		return evalParams->middlegameValues[type];
+	}
 }
 
 void EvalBoard::IterDeepSearch()
 {
-	bShouldSearch = true;
 	bSearching = true;
 	SetupBoardFromFEN(fen);
 	RecoverPieceMovedState(pieceMovedStates);
 	CalculateMoves();
+	PrepEvaluation();
 	
 	bEarlyExit = false;
+	AgeMoveOrdering();
+	nodes = 0;
+	completedDepth = 0;
+	multiPVLines.clear();
+
+	// entries from earlier moves of the game stay, only marked as older than anything this search writes
+	transpositionTable->NewSearch();
+	for (int i = 0; i < previousPVLength; i++)
+	{
+		transpositionTable->Store(previousPVKeys[i], 0, 0, previousPV[i].startTile, previousPV[i].endTile, TranspositionTable::Bound::NONE);
+	}
+
+	for (size_t i = 0; i < helpers.size(); i++)
+	{
+		EvalBoard* helper = helpers[i];
+		helper->SetFEN(fen);
+		helper->SetMovedStates(pieceMovedStates);
+		helper->SetCurrentTurn(currentTurn);
+		helper->network = network;
+		helper->evalMode = evalMode;
+		helper->evalFile = evalFile;
+		helper->evalParams = evalParams;
+		helper->searchControl.Start();
+		helper->worker.Run([helper, i] { helper->HelperSearch(i + 1); });
+	}
+
 	int depth = 1;
-	while (depth <= maxDepth && bShouldSearch)
+	int previousEval = 0;
+	while ((depth <= maxDepth || searchControl.IsPondering()) && depth <= MAX_ITERATION_DEPTH && !searchControl.ShouldStop())
 	{
+#ifdef TESTING
 		printf("\nCalculating eval at depth %i...\n", depth);
-		int eval = Search(1, depth) * (currentTurn == PieceTeam::WHITE ? 1 : -1);
+#endif
+
+		extensionLimit = std::min(2 * depth, MAX_PLY - 8);
+		int eval = AspirationSearch(depth, previousEval);
 		if (bEarlyExit)
 		{
 			break;
 		}
+		previousEval = eval;
+		eval *= currentTurn == PieceTeam::WHITE ? 1 : -1;
+		this->eval = eval;
+		completedDepth = depth;
+
+		previousPVLength = searchStack[1].pvLength;
+		std::copy(searchStack[1].pv, searchStack[1].pv + previousPVLength, previousPV);
+		std::copy(searchStack[1].pvKeys, searchStack[1].pvKeys + previousPVLength, previousPVKeys);
+
+		Move ponderReply = searchStack[1].pvLength > 1 ? searchStack[1].pv[1] : Move();
+		searchControl.Publish(bestMoveStart, bestMoveEnd, ponderReply.startTile, ponderReply.endTile, eval, depth);
+
+#ifdef TESTING
 		printf("Depth %i, Eval: %i %s\n", depth, eval, currentTurn == PieceTeam::WHITE ? "WHITE" : "BLACK");
+		if (std::abs(eval) >= MATE_BOUND)
+		{
+			printf("%s mates in %i\n", eval > 0 ? "WHITE" : "BLACK", (MATE_EVAL - std::abs(eval)) / 2);
+		}
 		printf("Best move: %s %s\n", ToBoard(bestMoveStart).c_str(), ToBoard(bestMoveEnd).c_str());
+#endif
+
+		RecordPVLine(0, eval, depth);
+		SearchOtherPVLines(depth);
 		depth++;
 	}
 
+	uint64_t totalNodes = nodes;
+	for (size_t i = 0; i < helpers.size(); i++)
+	{
+		helpers[i]->searchControl.Stop();
+		helpers[i]->worker.Wait();
+		totalNodes += helpers[i]->nodes;
+	}
+
+#ifdef TESTING
 	if (bEarlyExit)
 	{
 		printf("Search cancelled!\n");
@@ -461,8 +2259,125 @@ void EvalBoard::IterDeepSearch()
 	{
 		printf("Search done!\n");
 	}
+	printf("Searched %llu nodes on %i threads.\n", (unsigned long long)totalNodes, (int)helpers.size() + 1);
+#endif
 
 	bSearching = false;
-	bShouldSearch = false;
+	searchControl.Stop();
 	return;
 }
+
+int EvalBoard::AspirationSearch(const int depth, const int previousEval)
+{
+	// after the first iteration, search inside a window around the previous eval and widen it on the side that fails
+	int window = ASPIRATION_WINDOW;
+	int alpha = depth == 1 ? -INFINITE_EVAL : std::max(previousEval - window, -INFINITE_EVAL);
+	int beta = depth == 1 ? INFINITE_EVAL : std::min(previousEval + window, INFINITE_EVAL);
+	int eval = 0;
+
+	while (true)
+	{
+		eval = Search(1, depth, alpha, beta);
+		if (bEarlyExit)
+		{
+			break;
+		}
+
+		window *= 2;
+		if (eval <= alpha && alpha > -INFINITE_EVAL)
+		{
+			alpha = std::max(eval - window, -INFINITE_EVAL);
+		}
+		else if (eval >= beta && beta < INFINITE_EVAL)
+		{
+			beta = std::min(eval + window, INFINITE_EVAL);
+		}
+		else
+		{
+			break;
+		}
+	}
+
+	return eval;
+}
+
+void EvalBoard::SearchOtherPVLines(const int depth)
+{
+	// Each further line searches the root again with the moves heading the lines already found left out. The table,
+	// history and killers filled by the earlier lines order the search, so every extra line costs a fraction of the first
+	rootExcluded.clear();
+	for (int line = 1; line < multiPVCount && !multiPVLines[line - 1].moves.empty(); line++)
+	{
+		rootExcluded.push_back(multiPVLines[line - 1].moves[0]);
+
+		// the same line at the previous depth, when there was one, gives the window to start from
+		int perspective = currentTurn == PieceTeam::WHITE ? 1 : -1;
+		bool bPreviousLine = depth > 1 && line < (int)multiPVLines.size() && multiPVLines[line].depth == depth - 1;
+
+		multiPVIndex = line;
+		int eval = bPreviousLine ? AspirationSearch(depth, multiPVLines[line].eval * perspective) : Search(1, depth, -INFINITE_EVAL, INFINITE_EVAL);
+		multiPVIndex = 0;
+
+		// nothing left to search
+		if (bEarlyExit || searchStack[1].pvLength == 0)
+		{
+			break;
+		}
+
+		RecordPVLine(line, eval * perspective, depth);
+	}
+	rootExcluded.clear();
+}
+
+void EvalBoard::RecordPVLine(const int line, const int eval, const int depth)
+{
+	if ((int)multiPVLines.size() <= line)
+	{
+		multiPVLines.resize(line + 1);
+	}
+
+	PVLine& pvLine = multiPVLines[line];
+	pvLine.moves.assign(searchStack[1].pv, searchStack[1].pv + searchStack[1].pvLength);
+	pvLine.eval = eval;
+	pvLine.depth = depth;
+
+#ifdef TESTING
+	printf("Line %i, Eval: %i, PV:", line + 1, eval);
+	for (const Move& move : pvLine.moves)
+	{
+		printf(" %s%s", ToBoard(move.startTile).c_str(), ToBoard(move.endTile).c_str());
+	}
+	printf("\n");
+#endif
+}
+
+void EvalBoard::HelperSearch(int threadIndex)
+{
+	bSearching = true;
+	SetupBoardFromFEN(fen);
+	RecoverPieceMovedState(pieceMovedStates);
+	lastMoveStart = -1;
+	lastMoveEnd = -1;
+	CalculateMoves();
+	PrepEvaluation();
+
+	bEarlyExit = false;
+	AgeMoveOrdering();
+	nodes = 0;
+
+	// odd helpers start one ply deeper than the main search so the threads spread over different depths, and all of
+	// them keep deepening to fill the table until the main search is done and stops them
+	int depth = 1 + threadIndex % 2;
+	while (!searchControl.ShouldStop() && depth <= MAX_ITERATION_DEPTH)
+	{
+		extensionLimit = std::min(2 * depth, MAX_PLY - 8);
+		Search(1, depth, -INFINITE_EVAL, INFINITE_EVAL);
+		if (bEarlyExit)
+		{
+			break;
+		}
+		depth++;
+	}
+
+	bSearching = false;
+}
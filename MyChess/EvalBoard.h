@@ -1,8 +1,22 @@
 #pragma once
 
 #include <thread>
+#include <cstdint>
+#include <memory>
+#include <future>
 
 #include "Board.h"
+#include "TranspositionTable.h"
+#include "SearchWorker.h"
+#include "SearchControl.h"
+#include "Nnue.h"
+#include "WeightsFile.h"
+#include "PawnTable.h"
+#include "MaterialTable.h"
+#include "EvalCache.h"
+
+struct EvalParameters;
+struct EvalTrace;
 
 class EvalBoard : public Board
 {
@@ -11,73 +25,376 @@ public:
 	~EvalBoard();
 
 	void Init(Board* newBoard, irrklang::ISoundEngine* engine);
+	// for boards which only set up positions and evaluate them, like the tuner's, without rendering, sound or searching
+	void InitHeadless();
+
+	// Lazy SMP: every thread beyond the first runs its own iterative deepening on a copy of the position,
+	// sharing only the transposition table with the main search
+	void SetThreadCount(int count);
+
+	struct PVLine
+	{
+		std::vector<Move> moves;
+		int eval;
+		int depth;
+	};
+
+	struct SearchResult
+	{
+		int startTile;
+		int endTile;
+		int eval;
+		int depth;
+		std::vector<PVLine> lines; // best first, one per MultiPV line
+	};
+
+	// number of distinct root moves to find a principal variation, eval and depth for. Only the first line decides
+	// the move played, the rest are for analysis
+	void SetMultiPV(int count) { multiPVCount = std::clamp(count, 1, 64); }
+
+	// Forward pruning near the leaves, for nodes off the principal variation and not in check. Margins are in the same
+	// units as EvaluatePosition() and are multiplied by the remaining depth, depths are the most remaining depth each
+	// applies at. Set before a search starts
+	struct PruningMargins
+	{
+		int reverseFutility = 100;
+		int reverseFutilityDepth = 4;
+		int futility = 200;
+		int futilityDepth = 3;
+		int razoring = 300;
+		int razoringDepth = 2;
+		int lateMovePruningBase = 3; // quiet moves after base + depth * depth are skipped
+		int lateMovePruningDepth = 3;
+	};
+	void SetPruningMargins(const PruningMargins& margins) { pruning = margins; }
+
+	// evaluation used by the search. NNUE needs a network loaded by LoadNetwork() and falls back to the tables without one
+	enum class EvalMode
+	{
+		TABLES,
+		NNUE
+	};
+	bool LoadNetwork(const std::string& path);
+	void SetEvalMode(EvalMode mode);
+
+	// maps piece values and piece-square tables from a WeightsFile of EVAL_PARAMETERS content in place of the built in ones
+	bool LoadEvalParameters(const std::string& path);
 
+	// sets up the position from the piece placement of a FEN and fills in the parameters its table eval uses.
+	// Returns the eval from white's side, for checking the trace against
+	int TracePosition(const std::string& placement, PieceTeam turn, EvalTrace& trace);
+
+	// starts a search on the search worker, the result of which can be waited on through GetResult()
 	void StartEval(const int depth);
 	void StopEval();
 
+	// Searches during the opponent's turn from the position after the reply the last search expected. If the opponent
+	// plays that move, PonderHit() returns true and the running search carries on as the search for the next move,
+	// otherwise it should be stopped and a new search started. The FEN and moved states set beforehand have to be for
+	// position, the board the player is looking at, which the guessed move is checked against being played on
+	void StartPonder(const int depth, const std::string& position);
+
+	// the transposition table, move ordering statistics and PV are kept from one move to the next, so they have to be
+	// cleared when a new game starts
+	void NewGame();
+	bool PonderHit(int startTile, int endTile, PieceType promotedType);
+	bool IsPondering() const { return searchControl.IsPondering(); }
+	std::shared_future<SearchResult> GetResult() const { return result; }
+
 	void SetFEN(std::string fen) { this->fen = fen; }
 	void SetMovedStates(const std::vector<PieceMovedState>& pieceMovedStates);
 	void SetCurrentTurn(PieceTeam team) { currentTurn = team; }
 
-	int GetEval() const { return eval; }
-	bool IsSearching() const { return bSearching; }
+	// eval of the last completed iteration, safe to read while the search is running
+	int GetEval() const { return searchControl.GetPublished().eval; }
+	bool IsSearching() { return worker.IsBusy(); }
 
 	void IterDeepSearch();
 
 	void ShannonTestCallback();
 
 private:
+	static const int MAX_PLY = 64;
+	static constexpr int HISTORY_MAX = 16384;
+	static const int ASPIRATION_WINDOW = 25; // initial half width of the window around the previous iteration's eval
+	static const int MAX_ITERATION_DEPTH = MAX_PLY / 2; // pondering keeps deepening up to here
+
+	// Mate is scored as MATE_EVAL less the ply it happens on, so a quicker mate always scores higher. Anything beyond
+	// MATE_BOUND is a mate, and INFINITE_EVAL is outside every eval the search can return
+	static constexpr int INFINITE_EVAL = 32000;
+	static const int MATE_EVAL = 31000;
+	static const int MATE_BOUND = MATE_EVAL - MAX_PLY;
+
+	static int MatedEval(const int ply) { return -MATE_EVAL + ply; }
+
+	// the table is shared by nodes at every ply, so mates are stored as the distance from the stored position rather
+	// than from the root, and converted back for the ply they are probed at
+	static int EvalToTable(const int eval, const int ply) { return eval >= MATE_BOUND ? eval + ply : eval <= -MATE_BOUND ? eval - ply : eval; }
+	static int EvalFromTable(const int eval, const int ply) { return eval >= MATE_BOUND ? eval - ply : eval <= -MATE_BOUND ? eval + ply : eval; }
+
 	Board* board;
 	
 	bool bTesting;
-	bool bShouldSearch;
-	bool bEarlyExit;
+	bool bEarlyExit; // only touched by the thread running this board's search
 	int eval;
 	int maxDepth;
+	int completedDepth;
+	uint64_t nodes;
+
+	SearchWorker worker;
+	SearchControl searchControl;
+	std::promise<SearchResult> resultPromise;
+	std::shared_future<SearchResult> result;
+
+	std::vector<EvalBoard*> helpers;
+	std::shared_ptr<TranspositionTable> transpositionTable;
+	bool bHelper; // searches only to fill the shared table, never picks a move
+
+	void InitHelper(EvalBoard* mainBoard);
+	bool SetupPonderPosition(Move predicted, const std::string& position);
+	void HelperSearch(int threadIndex);
+
+	uint64_t zobristPieces[3][8][64]; // indexed by PieceTeam, PieceType and tile
+	uint64_t zobristUnmoved[64]; // kings, rooks and pawns which haven't moved yet, covers castling and double pawn moves
+	uint64_t zobristBlackToMove;
+	void PrepZobristKeys();
+	uint64_t ComputeHash() const;
+	uint64_t HashKey() const; // what ComputeHash() would return, put together from the keys in evalScores
 
 	std::string fen;
 
 	std::vector<PieceMovedState> pieceMovedStates;
 
+	// Material and piece-square sums, white minus black, and the keys of the material and pawns. Kept up to date by
+	// MakeMove() and restored with the rest of the board when a move is undone, so evaluating a leaf doesn't have to look
+	// at every tile
+	struct EvalScores
+	{
+		int middlegame;
+		int endgame;
+		uint64_t materialKey; // piece counts, as MaterialTable reads them
+		uint64_t pieceKey; // zobrist keys of every piece, which with the side to move keys the eval cache
+		uint64_t pawnKey; // zobrist keys of the pawns alone
+		uint64_t unmovedKey; // zobrist keys of the kings, rooks and pawns which haven't moved yet
+		uint64_t enPassantKey; // zobrist key of the en passant tile the last move left, if any
+		int kingTiles[2]; // white's, then black's
+
+		bool operator== (const EvalScores& other) const = default;
+	};
+	EvalScores evalScores;
+	EvalScores CalcEvalScores() const;
+	void UpdateEvalScores(PieceTeam team, PieceType type, int tile, int sign);
+
+	// points into evalFile when parameters have been loaded, otherwise at the built in defaults
+	const EvalParameters* evalParams;
+	std::shared_ptr<const WeightsFile> evalFile;
+
+	// shared with the helpers like the transposition table, the accumulator is updated alongside evalScores
+	EvalMode evalMode;
+	std::shared_ptr<const NnueNetwork> network;
+	NnueNetwork::Accumulator accumulator;
+	void RefreshAccumulator(PieceTeam perspective);
+
+	// counts evalScores and refreshes the accumulator from scratch, once per search
+	void PrepEvaluation();
+
+	// per thread like the pawn and material tables, which are cleared with it whenever the eval itself changes
+	mutable EvalCache evalCache;
+	void ClearEvalCaches();
+
+	// pawn structure terms for the pawns on the board, looked up by evalScores.pawnKey and only worked out on a miss.
+	// Each thread has its own table, which only caches, so it is filled in from const evaluation
+	mutable PawnTable pawnTable;
+	const PawnTable::Entry& ProbePawns() const;
+	void EvaluatePawns(PawnTable::Entry& entry, EvalTrace* trace = nullptr) const;
+
+	// Pawn shield, mobility and king attack units, white minus black, read from the move lists CalculateMoves() already
+	// filled in for the position. A piece's mobility is the tiles it can move to which no enemy pawn attacks, and every
+	// tile of the enemy king's surroundings it attacks adds kingAttackWeights to the attack units against that king
+	void EvaluateActivity(const PawnTable::Entry& pawns, int& middlegame, int& endgame, EvalTrace* trace = nullptr) const;
+
+	// counts uses of a parameter, middlegame and endgame for a pair, into the trace when the eval is being traced
+	void TraceParameter(EvalTrace* trace, const int32_t& parameter, int count) const;
+	void TraceParameters(EvalTrace* trace, const int32_t (&pair)[2], int count) const;
+
+	// imbalance, phase, scaling and endgame dispatch for the material on the board, looked up by evalScores.materialKey
+	mutable MaterialTable materialTable;
+	const MaterialTable::Entry& ProbeMaterial() const;
+	void EvaluateMaterial(MaterialTable::Entry& entry, EvalTrace* trace = nullptr) const;
+	bool HasOppositeBishops() const;
+	int EndgameScale(int endgame, const MaterialTable::Entry& material) const;
+
+	// specialised endgames, which drive the lone king to the edge, or for KBNK to a corner the bishop covers, and bring
+	// the strong king close to it, so the search can find the mate
+	static int EvaluateKXK(const EvalBoard& board, PieceTeam strongTeam);
+	static int EvaluateKBNK(const EvalBoard& board, PieceTeam strongTeam);
+
+	// MovePiece() for the search, which also updates evalScores when the move is legal
+	bool MakeMove(int startTile, int endTile);
+
+	// plain copy of everything a move changes, captured into the search stack so undoing a move never allocates
 	struct BoardState
 	{
-		BoardState(EvalBoard* board)
+		void Capture(const EvalBoard* board)
 		{
-			fen = board->BoardToFEN();
-			board->CapturePieceMovedState(pieceMovedStates);
-			this->kingXRay = board->kingXRay;
+			for (int i = 0; i < 64; i++)
+			{
+				teams[i] = board->pieces[i].GetTeam();
+				types[i] = board->pieces[i].GetType();
+				bMoved[i] = board->pieces[i].bMoved;
+			}
+			enPassantOwner = board->enPassantOwner;
+			kingXRay = board->kingXRay;
+			attackSetWhite = board->attackSetWhite;
+			attackSetBlack = board->attackSetBlack;
 			turn = board->currentTurn;
 			bLocalCheckWhite = board->bInCheckWhite;
 			bLocalCheckBlack = board->bInCheckBlack;
-			this->lastMoveStart = board->lastMoveStart;
-			this->lastMoveEnd = board->lastMoveEnd;
-		}
-
-		~BoardState()
-		{
-
+			lastMoveStart = board->lastMoveStart;
+			lastMoveEnd = board->lastMoveEnd;
+			evalScores = board->evalScores;
 		}
 
-		std::string fen;
-		std::vector<PieceMovedState> pieceMovedStates;
-		std::set<int> kingXRay;
+		PieceTeam teams[64];
+		PieceType types[64];
+		bool bMoved[64];
+		int enPassantOwner;
+		TileSet kingXRay;
+		TileSet attackSetWhite;
+		TileSet attackSetBlack;
 		PieceTeam turn;
 		bool bLocalCheckWhite;
 		bool bLocalCheckBlack;
 		int lastMoveStart;
 		int lastMoveEnd;
+		EvalScores evalScores;
+	};
+
+	// One frame per ply, allocated once and reused for the whole search. Every container is reserved up front for the
+	// largest position it can hold, so saving a position, generating and ordering its moves never touch the heap
+	struct SearchFrame
+	{
+		BoardState boardState;
+		std::vector<int> attackMap[64];
+		std::vector<int> opponentAttackMap[64]; // not needed to generate moves, but the eval reads both sides' moves
+		std::vector<CheckingPiece> checkingPieces;
+		std::vector<Move> moves;
+		std::vector<Move> quietsTried;
+		std::vector<Move> bestMoves;
+		int staticEval;
+		int captureTile; // end tile of the move being searched from this frame if it captures, otherwise -1
+		NnueNetwork::Accumulator accumulator; // only saved when evaluating with NNUE
+		uint64_t hashKey;
+		Move pv[MAX_PLY];
+		uint64_t pvKeys[MAX_PLY]; // hash of the position each PV move is played from
+		int pvLength;
 	};
 
-	void RecoverBoardState(BoardState* boardState);
+	std::unique_ptr<SearchFrame[]> searchStack;
+	void PrepSearchStack();
+	void SaveFrame(SearchFrame& frame);
+	void UpdatePV(const int ply, const Move& move);
+
+	PruningMargins pruning;
+
+	int multiPVCount;
+	int multiPVIndex; // line the root is being searched for, moves heading earlier lines are in rootExcluded
+	std::vector<Move> rootExcluded;
+	std::vector<PVLine> multiPVLines;
+	int AspirationSearch(const int depth, const int previousEval);
+	void SearchOtherPVLines(const int depth);
+	void RecordPVLine(const int line, const int eval, const int depth);
+
+	// principal variation of the last completed iteration, put back into the transposition table by the next search
+	// so its moves are searched first even if their entries have since been replaced
+	Move previousPV[MAX_PLY];
+	uint64_t previousPVKeys[MAX_PLY];
+	int previousPVLength;
+
+	void RecoverBoardState(const BoardState& boardState);
+	void UndoMove(const SearchFrame& frame);
 
 	int ShannonTest(const int ply, const int depth);
 
 	virtual void HandleEval() override;
+	// centipawns for the side to move, material and piece-square tables blended between middlegame and endgame by phase,
+	// with the endgame score scaled down for drawish material
 	int EvaluatePosition() const;
+	// Lazy evaluation: when material, piece-square tables and imbalance alone are LAZY_EVAL_MARGIN beyond the window,
+	// that score is returned without the pawn, king safety and mobility terms and bExact is cleared
+	static const int LAZY_EVAL_MARGIN = 500;
+	int EvaluatePosition(int alpha, int beta, bool& bExact) const;
+	int BlendPhases(int middlegame, int endgame, const MaterialTable::Entry& material) const;
 
-	// Returns eval as experienced by currentTeam. For example, if black is up by 2 pawns and it is black's turn, the function will return 2.
+	// EvaluatePosition() through the eval cache, which is what the search calls. Only exact evals are cached, so a
+	// lazy one for a narrow window never stands in for the full eval later
+	int StaticEval(int alpha = -INFINITE_EVAL, int beta = INFINITE_EVAL) const;
+
+	// Returns eval as experienced by currentTeam. For example, if black is up by 2 pawns and it is black's turn, the function will return about 200.
 	// For normalised eval, multiply by 1 if currentTeam == WHITE and multiply by -1 if currentTeam == BLACK
-	int Search(const int ply, const int depth);
-	int SearchAllCaptures(bool bCaptureFound);
+	// excludedMove is left out of the node, which is then neither cut by nor stored in the transposition table
+	int Search(const int ply, const int depth, int alpha, int beta, bool bAllowNullMove = true, const Move& excludedMove = Move());
+	int SearchAllCaptures(const int ply, int alpha, int beta);
+
+	// null move pruning, searched with depth reduced by NULL_MOVE_REDUCTION plus one ply for every 4 plies of remaining depth.
+	// A fail high found with at least NULL_MOVE_VERIFY_DEPTH remaining is confirmed by a reduced search without null moves,
+	// so zugzwang positions where passing would be the best move are not pruned
+	static const int NULL_MOVE_REDUCTION = 2;
+	static const int NULL_MOVE_VERIFY_DEPTH = 5;
+
+	// Search extensions, one ply at most per move: moves giving check, recaptures on the tile the previous move captured on
+	// at PV nodes, and the hash move when it is singular. The hash move is singular when a search at half the remaining depth
+	// with it left out fails low against its stored eval less SINGULAR_MARGIN, tried from SINGULAR_EXTENSION_DEPTH remaining
+	// depth with a stored lower bound or exact eval at most 3 plies shallower. No line is extended beyond twice the
+	// iteration depth, which keeps every search well inside MAX_PLY
+	static const int SINGULAR_EXTENSION_DEPTH = 4;
+	static const int SINGULAR_MARGIN = 50;
+	int extensionLimit;
+
+	// late move reductions, indexed by remaining depth and move number. Quiet moves late in the ordering are searched
+	// at reduced depth with a null window and only searched again at full depth if they beat alpha
+	int lateMoveReductions[MAX_PLY][64];
+	void PrepReductions();
+
+	void MakeNullMove();
+	bool HasNonPawnMaterial(PieceTeam team) const;
+
+	bool IsCapture(int startTile, int endTile) const;
+	bool IsPromotion(int startTile, int endTile) const;
+	void GenerateMoves(const std::vector<int> (&attackMap)[64], std::vector<Move>& moves, bool bCapturesOnly) const;
+	void OrderMoves(std::vector<Move>& moves, const int ply, const Move& hashMove) const;
+	static void SortMoves(std::vector<Move>& moves);
+
+	// quiet move ordering heuristics, filled in whenever a quiet move causes a beta cutoff
+	Move killerMoves[MAX_PLY][2];
+	int history[3][64][64]; // indexed by PieceTeam, start tile and end tile
+	Move counterMoves[64][64]; // indexed by the start and end tile of the move being replied to
+
+	void ClearMoveOrdering();
+	void AgeMoveOrdering();
+	void UpdateHistory(PieceTeam team, const Move& move, int bonus);
+	void UpdateQuietMoveOrdering(const int ply, const int depth, const Move& move, const std::vector<Move>& quietsTried);
+
+	// precomputed attack masks, used to find every attacker of a tile without generating or playing moves
+	uint64_t knightMasks[64];
+	uint64_t kingMasks[64];
+	uint64_t pawnAttackerMasks[3][64]; // indexed by PieceTeam, tiles a pawn of that team attacks the given tile from
+	int rays[64][8][7];
+	int rayLengths[64][8];
+
+	// pawn structure masks, indexed by PieceTeam and the pawn's tile. Ahead means towards the side's promotion rank
+	uint64_t adjacentFileMasks[8]; // the files either side of the given file
+	uint64_t pawnFrontSpans[3][64]; // tiles ahead on the pawn's own file
+	uint64_t pawnAttackSpans[3][64]; // tiles ahead on the files either side, which the pawn can attack by advancing
+	uint64_t pawnShieldMasks[3][64]; // for a king, the two ranks in front of it on its own file and those either side
+	void PrepAttackMasks();
+
+	uint64_t GetOccupancy() const;
+	uint64_t AttackersTo(int tile, uint64_t occupancy) const;
+
+	// Static exchange evaluation. Returns the material balance for the moving side after all captures on endTile are played out,
+	// least valuable attacker first, including pieces revealed behind other attackers (x-rays).
+	int StaticExchangeEval(int startTile, int endTile) const;
+	int SeeValue(PieceType type) const;
 };
 
@@ -0,0 +1,33 @@
+#include "EvalCache.h"
+
+EvalCache::EvalCache()
+{
+	entryCount = 0;
+	Resize(1);
+}
+
+EvalCache::~EvalCache()
+{
+}
+
+void EvalCache::Resize(size_t megabytes)
+{
+	// round down to a power of two so the slot can be found by masking the key
+	size_t count = 1;
+	while (count * 2 * sizeof(uint64_t) <= megabytes * 1024 * 1024)
+	{
+		count *= 2;
+	}
+
+	entries = std::make_unique<uint64_t[]>(count);
+	entryCount = count;
+	Clear();
+}
+
+void EvalCache::Clear()
+{
+	for (size_t i = 0; i < entryCount; i++)
+	{
+		entries[i] = 0;
+	}
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+
+// Cache of static evaluations keyed by the pieces on the board and the side to move. Iterative deepening reaches the
+// same positions again at every depth and transpositions reach them by other move orders, so the search looks here
+// before evaluating. Each entry is a single word, the upper bits of the key with the eval in the low 16 bits, so a
+// probe is one load and an entry can never be seen half written.
+class EvalCache
+{
+public:
+	EvalCache();
+	~EvalCache();
+
+	EvalCache(const EvalCache&) = delete;
+	EvalCache& operator= (const EvalCache&) = delete;
+
+	void Resize(size_t megabytes);
+	void Clear();
+
+	bool Probe(uint64_t key, int& eval) const
+	{
+		uint64_t entry = entries[key & (entryCount - 1)];
+		if ((entry ^ key) & KEY_MASK)
+		{
+			return false;
+		}
+
+		eval = (int16_t)(entry & ~KEY_MASK);
+		return true;
+	}
+
+	// evals have to fit in 16 bits, which every static eval does as they are kept clear of mate scores
+	void Store(uint64_t key, int eval)
+	{
+		entries[key & (entryCount - 1)] = (key & KEY_MASK) | (uint16_t)eval;
+	}
+
+private:
+	static const uint64_t KEY_MASK = ~0xFFFFull;
+
+	std::unique_ptr<uint64_t[]> entries;
+	size_t entryCount;
+};
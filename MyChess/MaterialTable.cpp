@@ -0,0 +1,20 @@
+#include "MaterialTable.h"
+
+MaterialTable::MaterialTable()
+{
+	entries = std::make_unique<Entry[]>(1ull << SLOT_BITS);
+	Clear();
+}
+
+MaterialTable::~MaterialTable()
+{
+}
+
+void MaterialTable::Clear()
+{
+	// no real position has an empty board, so a key of 0 never matches one
+	for (size_t i = 0; i < (1ull << SLOT_BITS); i++)
+	{
+		entries[i] = Entry{};
+	}
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+
+#include "CommonValues.h"
+
+class EvalBoard;
+
+// Cache of everything that depends only on how many pieces of each type are on the board: the imbalance terms, the
+// game phase, how far the endgame score is scaled down for drawish material and which endgame, if any, is evaluated by
+// a specialised function instead. Material only changes on captures and promotions, so nearly every probe hits.
+//
+// The key is the piece counts themselves, KEY_BITS a count for each team and type, so two material configurations
+// never share a key and an entry is only ever worked out once per configuration.
+class MaterialTable
+{
+public:
+	MaterialTable();
+	~MaterialTable();
+
+	MaterialTable(const MaterialTable&) = delete;
+	MaterialTable& operator= (const MaterialTable&) = delete;
+
+	static const int KEY_BITS = 4;
+	static const int SCALE_NORMAL = 64;
+
+	// added to the key for each piece of the given type and team
+	static uint64_t PieceKey(PieceTeam team, PieceType type) { return 1ull << KeyShift(team, type); }
+	static int Count(uint64_t key, PieceTeam team, PieceType type) { return (int)(key >> KeyShift(team, type)) & ((1 << KEY_BITS) - 1); }
+
+	// white minus black centipawns for the position, given the side that has the winning material
+	typedef int (*EndgameFunction)(const EvalBoard& board, PieceTeam strongTeam);
+
+	// scales are indexed by the side the endgame score favours, white then black
+	struct Entry
+	{
+		uint64_t key;
+		int middlegame; // imbalance, white minus black
+		int endgame;
+		int phase;
+		int scale[2]; // out of SCALE_NORMAL
+		bool bSingleBishops; // each side has one bishop and nothing else but pawns, so opposite coloured bishops are possible
+		EndgameFunction endgameFunction; // nullptr unless the material is a specialised endgame
+		PieceTeam strongTeam;
+	};
+
+	void Clear();
+
+	// slot the key maps to, whose key has to be compared to tell whether it holds this material
+	Entry& Slot(uint64_t key) { return entries[(key * 0x9E3779B97F4A7C15ull) >> (64 - SLOT_BITS)]; }
+
+private:
+	static const int SLOT_BITS = 13;
+	static int KeyShift(PieceTeam team, PieceType type) { return ((team == PieceTeam::WHITE ? 0 : 6) + type) * KEY_BITS; }
+	std::unique_ptr<Entry[]> entries;
+};
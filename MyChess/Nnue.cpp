@@ -0,0 +1,314 @@
+#include "Nnue.h"
+
+#include <algorithm>
+#include <cstdio>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define NNUE_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define NNUE_TARGET(arch)
+#else
+#define NNUE_TARGET(arch) __attribute__((target(arch)))
+#endif
+#endif
+
+// ========================================== KERNELS ==========================================
+
+static void AddColumnScalar(int16_t* values, const int16_t* column, int count)
+{
+	for (int i = 0; i < count; i++)
+	{
+		values[i] += column[i];
+	}
+}
+
+static void SubtractColumnScalar(int16_t* values, const int16_t* column, int count)
+{
+	for (int i = 0; i < count; i++)
+	{
+		values[i] -= column[i];
+	}
+}
+
+static void DenseScalar(const uint8_t* input, const int8_t* weights, const int32_t* biases, int32_t* output, int inputs, int outputs)
+{
+	for (int o = 0; o < outputs; o++)
+	{
+		const int8_t* row = weights + o * inputs;
+		int32_t sum = biases[o];
+		for (int i = 0; i < inputs; i++)
+		{
+			sum += input[i] * row[i];
+		}
+		output[o] = sum;
+	}
+}
+
+#ifdef NNUE_X86
+NNUE_TARGET("sse4.1")
+static void AddColumnSSE41(int16_t* values, const int16_t* column, int count)
+{
+	for (int i = 0; i < count; i += 8)
+	{
+		__m128i sum = _mm_add_epi16(_mm_load_si128((const __m128i*)(values + i)), _mm_load_si128((const __m128i*)(column + i)));
+		_mm_store_si128((__m128i*)(values + i), sum);
+	}
+}
+
+NNUE_TARGET("sse4.1")
+static void SubtractColumnSSE41(int16_t* values, const int16_t* column, int count)
+{
+	for (int i = 0; i < count; i += 8)
+	{
+		__m128i difference = _mm_sub_epi16(_mm_load_si128((const __m128i*)(values + i)), _mm_load_si128((const __m128i*)(column + i)));
+		_mm_store_si128((__m128i*)(values + i), difference);
+	}
+}
+
+NNUE_TARGET("avx2")
+static void AddColumnAVX2(int16_t* values, const int16_t* column, int count)
+{
+	for (int i = 0; i < count; i += 16)
+	{
+		__m256i sum = _mm256_add_epi16(_mm256_load_si256((const __m256i*)(values + i)), _mm256_load_si256((const __m256i*)(column + i)));
+		_mm256_store_si256((__m256i*)(values + i), sum);
+	}
+}
+
+NNUE_TARGET("avx2")
+static void SubtractColumnAVX2(int16_t* values, const int16_t* column, int count)
+{
+	for (int i = 0; i < count; i += 16)
+	{
+		__m256i difference = _mm256_sub_epi16(_mm256_load_si256((const __m256i*)(values + i)), _mm256_load_si256((const __m256i*)(column + i)));
+		_mm256_store_si256((__m256i*)(values + i), difference);
+	}
+}
+
+// inputs are at most 127, so the pairs of products summed by maddubs can't saturate int16
+NNUE_TARGET("sse4.1")
+static void DenseSSE41(const uint8_t* input, const int8_t* weights, const int32_t* biases, int32_t* output, int inputs, int outputs)
+{
+	const __m128i ones = _mm_set1_epi16(1);
+	for (int o = 0; o < outputs; o++)
+	{
+		const int8_t* row = weights + o * inputs;
+		__m128i sum = _mm_setzero_si128();
+		for (int i = 0; i < inputs; i += 16)
+		{
+			__m128i in = _mm_load_si128((const __m128i*)(input + i));
+			__m128i w = _mm_load_si128((const __m128i*)(row + i));
+			sum = _mm_add_epi32(sum, _mm_madd_epi16(_mm_maddubs_epi16(in, w), ones));
+		}
+		sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2)));
+		sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+		output[o] = biases[o] + _mm_cvtsi128_si32(sum);
+	}
+}
+
+NNUE_TARGET("avx2")
+static void DenseAVX2(const uint8_t* input, const int8_t* weights, const int32_t* biases, int32_t* output, int inputs, int outputs)
+{
+	const __m256i ones = _mm256_set1_epi16(1);
+	for (int o = 0; o < outputs; o++)
+	{
+		const int8_t* row = weights + o * inputs;
+		__m256i sum = _mm256_setzero_si256();
+		for (int i = 0; i < inputs; i += 32)
+		{
+			__m256i in = _mm256_load_si256((const __m256i*)(input + i));
+			__m256i w = _mm256_load_si256((const __m256i*)(row + i));
+			sum = _mm256_add_epi32(sum, _mm256_madd_epi16(_mm256_maddubs_epi16(in, w), ones));
+		}
+		__m128i half = _mm_add_epi32(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+		half = _mm_add_epi32(half, _mm_shuffle_epi32(half, _MM_SHUFFLE(1, 0, 3, 2)));
+		half = _mm_add_epi32(half, _mm_shuffle_epi32(half, _MM_SHUFFLE(2, 3, 0, 1)));
+		output[o] = biases[o] + _mm_cvtsi128_si32(half);
+	}
+}
+
+static bool CpuHasAVX2()
+{
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 0);
+	if (info[0] < 7)
+	{
+		return false;
+	}
+
+	// the OS has to save the upper halves of the ymm registers as well as the CPU supporting the instructions
+	__cpuid(info, 1);
+	bool bOSSavesYmm = (info[2] & (1 << 27)) && (_xgetbv(0) & 0x6) == 0x6;
+	__cpuidex(info, 7, 0);
+	return bOSSavesYmm && (info[1] & (1 << 5));
+#else
+	return __builtin_cpu_supports("avx2");
+#endif
+}
+
+static bool CpuHasSSE41()
+{
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 1);
+	return info[2] & (1 << 19);
+#else
+	return __builtin_cpu_supports("sse4.1");
+#endif
+}
+#endif
+
+void NnueNetwork::SelectKernels()
+{
+	dense = DenseScalar;
+	addColumn = AddColumnScalar;
+	subtractColumn = SubtractColumnScalar;
+#ifdef NNUE_X86
+	if (CpuHasAVX2())
+	{
+		dense = DenseAVX2;
+		addColumn = AddColumnAVX2;
+		subtractColumn = SubtractColumnAVX2;
+	}
+	else if (CpuHasSSE41())
+	{
+		dense = DenseSSE41;
+		addColumn = AddColumnSSE41;
+		subtractColumn = SubtractColumnSSE41;
+	}
+#endif
+}
+
+// ========================================== NETWORK ==========================================
+
+NnueNetwork::NnueNetwork()
+{
+	hiddenSize = 0;
+	featureBiases = nullptr;
+	featureWeights = nullptr;
+	for (int layer = 0; layer < 3; layer++)
+	{
+		hiddenWeights[layer] = nullptr;
+		hiddenBiases[layer] = nullptr;
+	}
+	dense = DenseScalar;
+	addColumn = AddColumnScalar;
+	subtractColumn = SubtractColumnScalar;
+}
+
+bool NnueNetwork::Load(const std::string& path)
+{
+	hiddenSize = 0;
+	if (!file.Open(path, WeightsFile::Content::NNUE))
+	{
+		return false;
+	}
+
+	const uint32_t* info = file.GetSection<uint32_t>(NETWORK_INFO, 2);
+	if (info == nullptr || info[0] != VERSION || info[1] == 0 || info[1] % 32 != 0 || info[1] > MAX_HIDDEN)
+	{
+		printf("Network file %s is not a version %u network\n", path.c_str(), VERSION);
+		file.Close();
+		return false;
+	}
+
+	int hidden = (int)info[1];
+	const int inputs[3] = { 2 * hidden, LAYER_SIZE, LAYER_SIZE };
+	const int outputs[3] = { LAYER_SIZE, LAYER_SIZE, 1 };
+
+	featureBiases = file.GetSection<int16_t>(FEATURE_BIASES, hidden);
+	featureWeights = file.GetSection<int16_t>(FEATURE_WEIGHTS, (size_t)FEATURES * hidden);
+	bool bFound = featureBiases != nullptr && featureWeights != nullptr;
+	for (int layer = 0; layer < 3; layer++)
+	{
+		hiddenWeights[layer] = file.GetSection<int8_t>(LAYER_WEIGHTS + 2 * layer, (size_t)inputs[layer] * outputs[layer]);
+		hiddenBiases[layer] = file.GetSection<int32_t>(LAYER_BIASES + 2 * layer, outputs[layer]);
+		bFound = bFound && hiddenWeights[layer] != nullptr && hiddenBiases[layer] != nullptr;
+	}
+
+	if (!bFound)
+	{
+		printf("Network file %s is missing sections or has the wrong layer sizes\n", path.c_str());
+		file.Close();
+		return false;
+	}
+
+	hiddenSize = hidden;
+	SelectKernels();
+	printf("Loaded network %s with %i hidden neurons\n", path.c_str(), hiddenSize);
+	return true;
+}
+
+int NnueNetwork::FeatureIndex(PieceTeam perspective, int kingTile, PieceTeam team, PieceType type, int tile)
+{
+	// tile 0 is a8, so black's view of the board is flipped vertically
+	int flip = perspective == PieceTeam::WHITE ? 0 : 56;
+	int piece = (team == perspective ? 0 : 6) + type;
+	return ((kingTile ^ flip) * 12 + piece) * 64 + (tile ^ flip);
+}
+
+void NnueNetwork::ResetAccumulator(Accumulator& accumulator, PieceTeam perspective, int kingTile) const
+{
+	int side = perspective == PieceTeam::WHITE ? 0 : 1;
+	std::copy(featureBiases, featureBiases + hiddenSize, accumulator.values[side]);
+	accumulator.kingTiles[side] = kingTile;
+}
+
+void NnueNetwork::AddFeature(Accumulator& accumulator, PieceTeam perspective, PieceTeam team, PieceType type, int tile) const
+{
+	int side = perspective == PieceTeam::WHITE ? 0 : 1;
+	const int16_t* column = &featureWeights[(size_t)FeatureIndex(perspective, accumulator.kingTiles[side], team, type, tile) * hiddenSize];
+	addColumn(accumulator.values[side], column, hiddenSize);
+}
+
+void NnueNetwork::RemoveFeature(Accumulator& accumulator, PieceTeam perspective, PieceTeam team, PieceType type, int tile) const
+{
+	int side = perspective == PieceTeam::WHITE ? 0 : 1;
+	const int16_t* column = &featureWeights[(size_t)FeatureIndex(perspective, accumulator.kingTiles[side], team, type, tile) * hiddenSize];
+	subtractColumn(accumulator.values[side], column, hiddenSize);
+}
+
+void NnueNetwork::AddPiece(Accumulator& accumulator, PieceTeam team, PieceType type, int tile) const
+{
+	AddFeature(accumulator, PieceTeam::WHITE, team, type, tile);
+	AddFeature(accumulator, PieceTeam::BLACK, team, type, tile);
+}
+
+void NnueNetwork::RemovePiece(Accumulator& accumulator, PieceTeam team, PieceType type, int tile) const
+{
+	RemoveFeature(accumulator, PieceTeam::WHITE, team, type, tile);
+	RemoveFeature(accumulator, PieceTeam::BLACK, team, type, tile);
+}
+
+int NnueNetwork::Evaluate(const Accumulator& accumulator, PieceTeam sideToMove) const
+{
+	alignas(32) uint8_t input[2 * MAX_HIDDEN];
+	alignas(32) uint8_t hiddenInput[LAYER_SIZE];
+	int32_t hiddenOutput[LAYER_SIZE];
+
+	int us = sideToMove == PieceTeam::WHITE ? 0 : 1;
+	for (int i = 0; i < hiddenSize; i++)
+	{
+		input[i] = (uint8_t)std::clamp<int>(accumulator.values[us][i], 0, 127);
+		input[hiddenSize + i] = (uint8_t)std::clamp<int>(accumulator.values[us ^ 1][i], 0, 127);
+	}
+
+	dense(input, hiddenWeights[0], hiddenBiases[0], hiddenOutput, 2 * hiddenSize, LAYER_SIZE);
+	for (int i = 0; i < LAYER_SIZE; i++)
+	{
+		hiddenInput[i] = (uint8_t)std::clamp(hiddenOutput[i] >> WEIGHT_SHIFT, 0, 127);
+	}
+
+	dense(hiddenInput, hiddenWeights[1], hiddenBiases[1], hiddenOutput, LAYER_SIZE, LAYER_SIZE);
+	for (int i = 0; i < LAYER_SIZE; i++)
+	{
+		hiddenInput[i] = (uint8_t)std::clamp(hiddenOutput[i] >> WEIGHT_SHIFT, 0, 127);
+	}
+
+	int32_t output;
+	dense(hiddenInput, hiddenWeights[2], hiddenBiases[2], &output, LAYER_SIZE, 1);
+	return output / OUTPUT_DIVISOR;
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include "CommonValues.h"
+#include "WeightsFile.h"
+
+// Efficiently updatable neural network evaluation, an optional replacement for the piece-square tables.
+//
+// Features are HalfKA: for each side's perspective, every piece (kings included) on every tile, paired with the tile of
+// that side's own king. Black sees the board flipped with the teams swapped, so both perspectives share one set of
+// weights. The first layer is an int16 accumulator per perspective, which a move only adds and subtracts a few weight
+// columns from, with a full refresh when a king moves. The accumulators, side to move first, are clipped to 0..127 and
+// fed through two int8 dense layers of 32 and an int8 output. The column updates and the dense layers use AVX2 or
+// SSE4.1 kernels when the CPU has them.
+class NnueNetwork
+{
+public:
+	NnueNetwork();
+
+	NnueNetwork(const NnueNetwork&) = delete;
+	NnueNetwork& operator= (const NnueNetwork&) = delete;
+
+	static const int MAX_HIDDEN = 512;
+	static const int FEATURES = 64 * 12 * 64; // king tile, piece from the perspective's side and tile
+	static const int LAYER_SIZE = 32;
+
+	// dense layer outputs are shifted down by WEIGHT_SHIFT before clipping, the output is divided into centipawns
+	static const int WEIGHT_SHIFT = 6;
+	static const int OUTPUT_DIVISOR = 16;
+
+	struct Accumulator
+	{
+		alignas(32) int16_t values[2][MAX_HIDDEN]; // white's perspective, then black's
+		int kingTiles[2];
+	};
+
+	// Maps a WeightsFile of NNUE content and uses the weights in place. Sections: NETWORK_INFO holds uint32 version and
+	// hidden size (a multiple of 32 up to MAX_HIDDEN), then int16 feature biases[hidden] and weights[FEATURES][hidden],
+	// and for each dense layer int8 weights[outputs][inputs] and int32 biases[outputs]. Returns false on any mismatch
+	bool Load(const std::string& path);
+
+	enum SectionId : uint32_t
+	{
+		NETWORK_INFO = 1,
+		FEATURE_BIASES = 2,
+		FEATURE_WEIGHTS = 3,
+		LAYER_WEIGHTS = 4, // layer n's weights are LAYER_WEIGHTS + 2n, its biases the section after
+		LAYER_BIASES = 5
+	};
+	bool IsLoaded() const { return hiddenSize > 0; }
+
+	// sets the perspective's accumulator to the biases for a king on kingTile, pieces are then added one at a time
+	void ResetAccumulator(Accumulator& accumulator, PieceTeam perspective, int kingTile) const;
+	void AddFeature(Accumulator& accumulator, PieceTeam perspective, PieceTeam team, PieceType type, int tile) const;
+	void RemoveFeature(Accumulator& accumulator, PieceTeam perspective, PieceTeam team, PieceType type, int tile) const;
+
+	// both perspectives at once, for pieces moved by a move
+	void AddPiece(Accumulator& accumulator, PieceTeam team, PieceType type, int tile) const;
+	void RemovePiece(Accumulator& accumulator, PieceTeam team, PieceType type, int tile) const;
+
+	// centipawns for sideToMove
+	int Evaluate(const Accumulator& accumulator, PieceTeam sideToMove) const;
+
+private:
+	static const uint32_t VERSION = 1;
+
+	int hiddenSize;
+	WeightsFile file;
+	const int16_t* featureBiases;
+	const int16_t* featureWeights;
+	const int8_t* hiddenWeights[3];
+	const int32_t* hiddenBiases[3];
+
+	static int FeatureIndex(PieceTeam perspective, int kingTile, PieceTeam team, PieceType type, int tile);
+
+	// output[o] = biases[o] + the dot product of input with row o of weights. Inputs are a multiple of 32, and input and
+	// weights are 32 byte aligned
+	using DenseKernel = void (*)(const uint8_t* input, const int8_t* weights, const int32_t* biases, int32_t* output, int inputs, int outputs);
+	DenseKernel dense;
+	// values[i] += or -= column[i]. The count is a multiple of 32, and values and column are 32 byte aligned
+	using AccumulateKernel = void (*)(int16_t* values, const int16_t* column, int count);
+	AccumulateKernel addColumn;
+	AccumulateKernel subtractColumn;
+	void SelectKernels();
+};
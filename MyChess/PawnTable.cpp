@@ -0,0 +1,34 @@
+#include "PawnTable.h"
+
+PawnTable::PawnTable()
+{
+	entryCount = 0;
+	Resize(1);
+}
+
+PawnTable::~PawnTable()
+{
+}
+
+void PawnTable::Resize(size_t megabytes)
+{
+	// round down to a power of two so the slot can be found by masking the key
+	size_t count = 1;
+	while (count * 2 * sizeof(Entry) <= megabytes * 1024 * 1024)
+	{
+		count *= 2;
+	}
+
+	entries = std::make_unique<Entry[]>(count);
+	entryCount = count;
+	Clear();
+}
+
+void PawnTable::Clear()
+{
+	// a key of 0 with empty masks is the correct entry for a board without pawns, so a cleared slot never misleads
+	for (size_t i = 0; i < entryCount; i++)
+	{
+		entries[i] = Entry{};
+	}
+}
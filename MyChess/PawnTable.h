@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+
+// Cache of pawn structure evaluations keyed by a hash of the pawns alone. Most moves leave the pawns where they were,
+// so nearly every leaf finds its pawn terms here instead of working them out again. Each search thread owns its own
+// table, so entries are plain structs without any locking.
+class PawnTable
+{
+public:
+	PawnTable();
+	~PawnTable();
+
+	PawnTable(const PawnTable&) = delete;
+	PawnTable& operator= (const PawnTable&) = delete;
+
+	// masks are indexed by side, white then black
+	struct Entry
+	{
+		uint64_t key;
+		int middlegame; // white minus black
+		int endgame;
+		uint64_t pawns[2];
+		uint64_t passed[2];
+		uint64_t attacks[2]; // tiles the side's pawns attack
+		uint64_t attackSpans[2]; // every tile the side's pawns attack now or could attack by advancing
+	};
+
+	void Resize(size_t megabytes);
+	void Clear();
+
+	// slot the key maps to, whose key has to be compared to tell whether it holds this pawn structure
+	Entry& Slot(uint64_t key) { return entries[key & (entryCount - 1)]; }
+
+private:
+	std::unique_ptr<Entry[]> entries;
+	size_t entryCount;
+};
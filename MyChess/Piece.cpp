@@ -2,8 +2,11 @@
 
 Piece::Piece()
 {
-	VAO, EBO, VBO = 0;
+	VAO = 0;
+	EBO = 0;
+	VBO = 0;
 	bMoved = false;
+	bEvalPiece = false;
 }
 
 Piece::~Piece()
@@ -27,6 +30,7 @@ void Piece::Init(PieceTeam team, PieceType type, bool bEvalPiece)
 	pieceTeam = team;
 	pieceType = type;
 	this->bMoved = bEvalPiece;
+	this->bEvalPiece = bEvalPiece;
 
 	switch (pieceType)
 	{
@@ -0,0 +1,70 @@
+#include "SearchControl.h"
+
+SearchControl::SearchControl()
+{
+	bStop.store(true);
+	bPondering.store(false);
+	published.store(Pack(-1, -1, -1, -1, 0, 0));
+	ponderMove.store(0);
+}
+
+void SearchControl::Start()
+{
+	bPondering.store(false, std::memory_order_relaxed);
+	published.store(Pack(-1, -1, -1, -1, 0, 0), std::memory_order_relaxed);
+	bStop.store(false, std::memory_order_release);
+}
+
+void SearchControl::Publish(int startTile, int endTile, int ponderStart, int ponderEnd, int eval, int depth)
+{
+	published.store(Pack(startTile, endTile, ponderStart, ponderEnd, eval, depth), std::memory_order_release);
+}
+
+SearchControl::PublishedMove SearchControl::GetPublished() const
+{
+	uint64_t data = published.load(std::memory_order_acquire);
+
+	PublishedMove move;
+	move.startTile = (int8_t)(data & 0xFF);
+	move.endTile = (int8_t)((data >> 8) & 0xFF);
+	move.ponderStart = (int8_t)((data >> 16) & 0xFF);
+	move.ponderEnd = (int8_t)((data >> 24) & 0xFF);
+	move.eval = (int16_t)((data >> 32) & 0xFFFF);
+	move.depth = (int)((data >> 48) & 0xFFFF);
+	return move;
+}
+
+void SearchControl::StartPondering(int startTile, int endTile, int pieceType)
+{
+	ponderMove.store(PackPonderMove(startTile, endTile, pieceType), std::memory_order_relaxed);
+	bPondering.store(true, std::memory_order_release);
+}
+
+bool SearchControl::PonderHit(int startTile, int endTile, int pieceType)
+{
+	if (!IsPondering() || ponderMove.load(std::memory_order_relaxed) != PackPonderMove(startTile, endTile, pieceType))
+	{
+		return false;
+	}
+
+	bPondering.store(false, std::memory_order_release);
+	return true;
+}
+
+uint64_t SearchControl::Pack(int startTile, int endTile, int ponderStart, int ponderEnd, int eval, int depth)
+{
+	// tiles: 8 bits each with -1 meaning no move, eval: 16 bits, depth: 16 bits
+	uint64_t data = (uint64_t)(uint8_t)(int8_t)startTile;
+	data |= (uint64_t)(uint8_t)(int8_t)endTile << 8;
+	data |= (uint64_t)(uint8_t)(int8_t)ponderStart << 16;
+	data |= (uint64_t)(uint8_t)(int8_t)ponderEnd << 24;
+	data |= (uint64_t)(uint16_t)(int16_t)eval << 32;
+	data |= (uint64_t)(uint16_t)depth << 48;
+	return data;
+}
+
+uint32_t SearchControl::PackPonderMove(int startTile, int endTile, int pieceType)
+{
+	// the piece type left on the end tile tells a queen promotion, which is all the search plays, from an underpromotion
+	return (uint32_t)(uint8_t)startTile | (uint32_t)(uint8_t)endTile << 8 | (uint32_t)(uint8_t)pieceType << 16;
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+// Flags shared between a search and the threads controlling it. The stop flag is checked at every node, so a search
+// answers StopEval() within a single node. The best move, expected reply, eval and depth of the last completed iteration
+// are packed into one 64 bit value, so a reader on another thread always gets them from the same iteration without a lock.
+class SearchControl
+{
+public:
+	SearchControl();
+
+	struct PublishedMove
+	{
+		int startTile;
+		int endTile;
+		int ponderStart; // the reply the search expects, -1 if it doesn't know one
+		int ponderEnd;
+		int eval;
+		int depth;
+	};
+
+	// clears the stop and ponder flags and the published move, call before the search thread is started
+	void Start();
+	void Stop() { bStop.store(true, std::memory_order_release); }
+	bool ShouldStop() const { return bStop.load(std::memory_order_relaxed); }
+
+	void Publish(int startTile, int endTile, int ponderStart, int ponderEnd, int eval, int depth);
+	PublishedMove GetPublished() const;
+
+	// a pondering search is running on a guess of the opponent's move. It keeps deepening until the guess is
+	// confirmed by PonderHit() with the move actually played, or the search is stopped
+	void StartPondering(int startTile, int endTile, int pieceType);
+	bool IsPondering() const { return bPondering.load(std::memory_order_acquire); }
+	bool PonderHit(int startTile, int endTile, int pieceType);
+
+private:
+	std::atomic<bool> bStop;
+	std::atomic<bool> bPondering;
+	std::atomic<uint64_t> published;
+	std::atomic<uint32_t> ponderMove;
+
+	static uint64_t Pack(int startTile, int endTile, int ponderStart, int ponderEnd, int eval, int depth);
+	static uint32_t PackPonderMove(int startTile, int endTile, int pieceType);
+};
@@ -0,0 +1,71 @@
+#include "SearchWorker.h"
+
+SearchWorker::SearchWorker()
+{
+	bBusy = false;
+	bQuit = false;
+
+	thread = std::thread([this] { this->WorkerLoop(); });
+}
+
+SearchWorker::~SearchWorker()
+{
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		jobDone.wait(lock, [this] { return !bBusy; });
+		bQuit = true;
+	}
+	jobReady.notify_one();
+
+	thread.join();
+}
+
+void SearchWorker::Run(std::function<void()> newJob)
+{
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		jobDone.wait(lock, [this] { return !bBusy; });
+		job = std::move(newJob);
+		bBusy = true;
+	}
+	jobReady.notify_one();
+}
+
+void SearchWorker::Wait()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	jobDone.wait(lock, [this] { return !bBusy; });
+}
+
+bool SearchWorker::IsBusy()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return bBusy;
+}
+
+void SearchWorker::WorkerLoop()
+{
+	while (true)
+	{
+		std::function<void()> currentJob;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			jobReady.wait(lock, [this] { return bBusy || bQuit; });
+
+			if (bQuit)
+			{
+				return;
+			}
+
+			currentJob = std::move(job);
+		}
+
+		currentJob();
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			bBusy = false;
+		}
+		jobDone.notify_all();
+	}
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+// A long lived thread which sleeps on a condition variable until it is handed a job, so searches don't have to
+// create a new thread every turn or poll to find out when the previous one has finished
+class SearchWorker
+{
+public:
+	SearchWorker();
+	~SearchWorker();
+
+	SearchWorker(const SearchWorker&) = delete;
+	SearchWorker& operator= (const SearchWorker&) = delete;
+
+	// waits for any job still running before handing over the new one
+	void Run(std::function<void()> newJob);
+	void Wait();
+	bool IsBusy();
+
+private:
+	void WorkerLoop();
+
+	std::thread thread;
+	std::mutex mutex;
+	std::condition_variable jobReady;
+	std::condition_variable jobDone;
+	std::function<void()> job;
+
+	bool bBusy;
+	bool bQuit;
+};
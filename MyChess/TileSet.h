@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <cassert>
+
+// Set of board tiles stored as one bit per tile. Keeps the std::set<int> interface the move generator was written
+// against, but inserting never allocates and copying it while saving or restoring a search position is a single word
+class TileSet
+{
+public:
+	TileSet() : mask(0) {}
+
+	void insert(int tile)
+	{
+		if (0 <= tile && tile < 64)
+		{
+			mask |= 1ULL << tile;
+		}
+	}
+
+	size_t count(int tile) const { return 0 <= tile && tile < 64 ? (mask >> tile) & 1 : 0; }
+	bool empty() const { return mask == 0; }
+	void clear() { mask = 0; }
+
+	uint64_t GetMask() const { return mask; }
+
+private:
+	uint64_t mask;
+};
+
+// Tiles in the order they were added, up to the eight a line of sight along a rank, file or diagonal can hold. Takes
+// the place of std::vector<int> for lines of sight, so checking and pinned pieces are copied without allocating
+class TileList
+{
+public:
+	TileList() : tiles(), length(0) {}
+
+	void push_back(int tile)
+	{
+		assert(length < CAPACITY);
+		tiles[length++] = tile;
+	}
+
+	size_t size() const { return length; }
+	bool empty() const { return length == 0; }
+	void clear() { length = 0; }
+
+	int operator[](size_t index) const { return tiles[index]; }
+	const int* begin() const { return tiles; }
+	const int* end() const { return tiles + length; }
+
+private:
+	static const int CAPACITY = 8;
+
+	int tiles[CAPACITY];
+	int length;
+};
@@ -0,0 +1,141 @@
+#include "TranspositionTable.h"
+
+TranspositionTable::TranspositionTable()
+{
+	bucketCount = 0;
+	generation = 0;
+	Resize(16);
+}
+
+TranspositionTable::~TranspositionTable()
+{
+}
+
+void TranspositionTable::Resize(size_t megabytes)
+{
+	// round down to a power of two so the bucket can be found by masking the key
+	size_t count = 1;
+	while (count * 2 * sizeof(Bucket) <= megabytes * 1024 * 1024)
+	{
+		count *= 2;
+	}
+
+	buckets = std::make_unique<Bucket[]>(count);
+	bucketCount = count;
+	Clear();
+}
+
+void TranspositionTable::Clear()
+{
+	for (size_t i = 0; i < bucketCount; i++)
+	{
+		for (Slot& slot : buckets[i].slots)
+		{
+			slot.key.store(0, std::memory_order_relaxed);
+			slot.data.store(0, std::memory_order_relaxed);
+		}
+	}
+	generation = 0;
+}
+
+bool TranspositionTable::Probe(uint64_t key, Entry& entry) const
+{
+	const Bucket& bucket = buckets[key & (bucketCount - 1)];
+	for (const Slot& slot : bucket.slots)
+	{
+		uint64_t data = slot.data.load(std::memory_order_relaxed);
+		uint64_t storedKey = slot.key.load(std::memory_order_relaxed);
+
+		if ((storedKey ^ data) == key && data != 0)
+		{
+			Unpack(data, entry);
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void TranspositionTable::Store(uint64_t key, int eval, int depth, int startTile, int endTile, Bound bound)
+{
+	Bucket& bucket = buckets[key & (bucketCount - 1)];
+
+	// overwrite this position's own slot if it has one, otherwise the slot worth least: empty slots first,
+	// then the one with the lowest depth, with every search since it was written counting against it
+	Slot* replace = nullptr;
+	int replaceWorth = 0;
+	for (Slot& slot : bucket.slots)
+	{
+		uint64_t data = slot.data.load(std::memory_order_relaxed);
+		if ((slot.key.load(std::memory_order_relaxed) ^ data) == key && data != 0)
+		{
+			replace = &slot;
+			break;
+		}
+
+		int worth = data == 0 ? -1000 : (int)((data >> 16) & 0xFF) - 8 * Age(data);
+		if (replace == nullptr || worth < replaceWorth)
+		{
+			replace = &slot;
+			replaceWorth = worth;
+		}
+	}
+
+	// keep a deeper result for the same position from this search unless the new one is exact
+	uint64_t oldData = replace->data.load(std::memory_order_relaxed);
+	if ((replace->key.load(std::memory_order_relaxed) ^ oldData) == key && oldData != 0)
+	{
+		Entry old;
+		Unpack(oldData, old);
+		if (bound != Bound::EXACT && Age(oldData) == 0 && old.depth > depth + 2)
+		{
+			return;
+		}
+
+		// a result without a move shouldn't throw away the move found by an earlier search of this position
+		if (startTile == -1)
+		{
+			startTile = old.startTile;
+			endTile = old.endTile;
+		}
+
+		// neither should a move without a result throw away the result
+		if (bound == Bound::NONE)
+		{
+			eval = old.eval;
+			depth = old.depth;
+			bound = old.bound;
+		}
+	}
+
+	uint64_t data = Pack(eval, depth, startTile, endTile, bound);
+	replace->key.store(key ^ data, std::memory_order_relaxed);
+	replace->data.store(data, std::memory_order_relaxed);
+}
+
+uint64_t TranspositionTable::Pack(int eval, int depth, int startTile, int endTile, Bound bound) const
+{
+	// eval: 16 bits, depth: 8 bits, start and end tile: 7 bits each with 127 meaning no move, bound: 2 bits, generation: 8 bits
+	uint64_t data = (uint64_t)(uint16_t)(int16_t)eval;
+	data |= (uint64_t)(uint8_t)depth << 16;
+	data |= (uint64_t)(startTile < 0 ? 127 : startTile) << 24;
+	data |= (uint64_t)(endTile < 0 ? 127 : endTile) << 31;
+	data |= (uint64_t)bound << 38;
+	data |= (uint64_t)generation << 40;
+	return data;
+}
+
+void TranspositionTable::Unpack(uint64_t data, Entry& entry)
+{
+	entry.eval = (int16_t)(data & 0xFFFF);
+	entry.depth = (int)((data >> 16) & 0xFF);
+	entry.startTile = (int)((data >> 24) & 0x7F);
+	entry.endTile = (int)((data >> 31) & 0x7F);
+	entry.bound = (Bound)((data >> 38) & 0x3);
+
+	if (entry.startTile == 127 || entry.endTile == 127)
+	{
+		entry.startTile = -1;
+		entry.endTile = -1;
+	}
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+// Cache of searched positions shared between every search thread and kept between moves of a game. Entries are
+// stored without locks: each slot holds the position key xor'd with its data, so a slot torn by two threads writing
+// at once simply fails to match on probe. Every entry records the search it was written in, so entries left over
+// from earlier moves are the first to be replaced.
+class TranspositionTable
+{
+public:
+	TranspositionTable();
+	~TranspositionTable();
+
+	enum class Bound : uint8_t
+	{
+		NONE = 0, // only the move is known, e.g. a move of the previous search's principal variation
+		EXACT = 1,
+		LOWER = 2, // search failed high, eval is at least this
+		UPPER = 3  // search failed low, eval is at most this
+	};
+
+	struct Entry
+	{
+		int eval;
+		int depth;
+		int startTile;
+		int endTile;
+		Bound bound;
+	};
+
+	void Resize(size_t megabytes);
+	void Clear();
+
+	// call once before each search, before any helper threads are started
+	void NewSearch() { generation++; }
+
+	bool Probe(uint64_t key, Entry& entry) const;
+	void Store(uint64_t key, int eval, int depth, int startTile, int endTile, Bound bound);
+
+private:
+	struct Slot
+	{
+		std::atomic<uint64_t> key;
+		std::atomic<uint64_t> data;
+	};
+
+	// a position may be stored in either slot of its bucket
+	static const int BUCKET_SLOTS = 2;
+	struct Bucket
+	{
+		Slot slots[BUCKET_SLOTS];
+	};
+
+	std::unique_ptr<Bucket[]> buckets;
+	size_t bucketCount;
+	uint8_t generation;
+
+	int Age(uint64_t data) const { return (uint8_t)(generation - (uint8_t)(data >> 40)); }
+
+	uint64_t Pack(int eval, int depth, int startTile, int endTile, Bound bound) const;
+	static void Unpack(uint64_t data, Entry& entry);
+};
@@ -0,0 +1,524 @@
+#include "Tuner.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <random>
+#include <thread>
+
+#include "EvalBoard.h"
+#include "MaterialTable.h"
+#include "SearchWorker.h"
+#include "WeightsFile.h"
+
+namespace
+{
+	const double LEARNING_RATE = 1.0;
+	const double ADAM_BETA1 = 0.9;
+	const double ADAM_BETA2 = 0.999;
+	const double ADAM_EPSILON = 1e-8;
+
+	const char* TABLE_NAMES[6] = { "king", "queen", "bishop", "knight", "rook", "pawn" };
+
+	// "{ 1, 2, 3 }"
+	std::string FormatList(const int32_t* values, int count)
+	{
+		std::string text = "{ ";
+		for (int i = 0; i < count; i++)
+		{
+			text += std::to_string(values[i]) + (i + 1 < count ? ", " : " ");
+		}
+		return text + "}";
+	}
+
+	// eight to a row, aligned the way the tables in EvalTables.h are
+	void WriteRows(std::ofstream& file, const int32_t* values, int count, const char* indent)
+	{
+		char number[16];
+		for (int i = 0; i < count; i++)
+		{
+			if (i % 8 == 0)
+			{
+				file << indent;
+			}
+
+			snprintf(number, sizeof(number), "%4d", values[i]);
+			file << number << (i + 1 < count ? "," : "") << (i % 8 == 7 || i + 1 == count ? "\n" : " ");
+		}
+	}
+}
+
+Tuner::Tuner()
+{
+	scalingConstant = 1.0;
+	threadCount = std::max(1, (int)std::thread::hardware_concurrency());
+	for (int i = 0; i < threadCount; i++)
+	{
+		workers.push_back(new SearchWorker());
+	}
+	PrepFeatures();
+}
+
+Tuner::~Tuner()
+{
+	for (SearchWorker* worker : workers)
+	{
+		delete worker;
+	}
+}
+
+void Tuner::PrepFeatures()
+{
+	const EvalParameters& params = defaultEvalParameters;
+	auto index = [&params](const int32_t& parameter) { return (int)(&parameter - reinterpret_cast<const int32_t*>(&params)); };
+	auto addPair = [&](const int32_t& middlegame, const int32_t& endgame) { features.push_back({ index(middlegame), index(endgame) }); };
+
+	// phaseWeights, mobilityBaseline and kingAttackWeights decide which terms apply rather than scoring anything, so
+	// the eval isn't linear in them and they keep their values
+	for (int type = KING; type <= PAWN; type++)
+	{
+		addPair(params.middlegameValues[type], params.endgameValues[type]);
+		for (int tile = 0; tile < 64; tile++)
+		{
+			addPair(params.middlegameTables[type][tile], params.endgameTables[type][tile]);
+		}
+		addPair(params.mobility[type][0], params.mobility[type][1]);
+	}
+
+	addPair(params.doubledPawn[0], params.doubledPawn[1]);
+	addPair(params.isolatedPawn[0], params.isolatedPawn[1]);
+	addPair(params.backwardPawn[0], params.backwardPawn[1]);
+	for (int rank = 0; rank < 8; rank++)
+	{
+		addPair(params.passedPawn[0][rank], params.passedPawn[1][rank]);
+	}
+	addPair(params.pawnShield[0], params.pawnShield[1]);
+	addPair(params.bishopPair[0], params.bishopPair[1]);
+	addPair(params.knightPawns[0], params.knightPawns[1]);
+	addPair(params.rookPawns[0], params.rookPawns[1]);
+	for (int units = 0; units < 64; units++)
+	{
+		features.push_back({ index(params.kingDanger[units]), -1 });
+	}
+
+	const int32_t* values = reinterpret_cast<const int32_t*>(&params);
+	for (const Feature& feature : features)
+	{
+		middlegameWeights.push_back(values[feature.middlegame]);
+		endgameWeights.push_back(feature.endgame >= 0 ? values[feature.endgame] : 0.0);
+	}
+}
+
+void Tuner::ForEachThread(size_t count, const std::function<void(size_t, size_t, int)>& job) const
+{
+	for (int i = 0; i < threadCount; i++)
+	{
+		size_t begin = count * i / threadCount;
+		size_t end = count * (i + 1) / threadCount;
+		workers[i]->Run([&job, begin, end, i] { job(begin, end, i); });
+	}
+
+	for (SearchWorker* worker : workers)
+	{
+		worker->Wait();
+	}
+}
+
+bool Tuner::LoadPositions(const std::string& path)
+{
+	std::ifstream file(path);
+	if (!file)
+	{
+		printf("Failed to open dataset %s\n", path.c_str());
+		return false;
+	}
+
+	auto start = std::chrono::steady_clock::now();
+
+	// each thread traces the lines it reads on a board of its own, then the shares are joined up with their
+	// coefficients moved along to follow the ones before
+	std::mutex fileMutex;
+	size_t lineCount = 0;
+	std::vector<std::vector<Position>> loaded(threadCount);
+	std::vector<std::vector<Coefficient>> loadedCoefficients(threadCount);
+	std::vector<double> traceErrors(threadCount, 0.0);
+	ForEachThread(threadCount, [&](size_t, size_t, int thread)
+		{
+			LoadLines(file, fileMutex, lineCount, loaded[thread], loadedCoefficients[thread], traceErrors[thread]);
+		});
+
+	size_t positionCount = 0;
+	size_t coefficientCount = 0;
+	for (int i = 0; i < threadCount; i++)
+	{
+		positionCount += loaded[i].size();
+		coefficientCount += loadedCoefficients[i].size();
+	}
+
+	if (coefficientCount > UINT32_MAX)
+	{
+		printf("Dataset %s is too large to tune in one go\n", path.c_str());
+		return false;
+	}
+
+	positions.clear();
+	coefficients.clear();
+	positions.reserve(positionCount);
+	coefficients.reserve(coefficientCount);
+
+	double traceError = 0.0;
+	for (int i = 0; i < threadCount; i++)
+	{
+		uint32_t offset = (uint32_t)coefficients.size();
+		for (Position& position : loaded[i])
+		{
+			position.firstCoefficient += offset;
+			positions.push_back(position);
+		}
+		coefficients.insert(coefficients.end(), loadedCoefficients[i].begin(), loadedCoefficients[i].end());
+		traceError += traceErrors[i];
+
+		loaded[i] = std::vector<Position>();
+		loadedCoefficients[i] = std::vector<Coefficient>();
+	}
+
+	// batches are taken in order, so they shouldn't all come from the same few games
+	std::shuffle(positions.begin(), positions.end(), std::mt19937(0));
+
+	std::chrono::duration<float> duration = std::chrono::steady_clock::now() - start;
+	printf("Loaded %zu of %zu positions from %s in %f seconds, %zu bytes each on average\n", positions.size(),
+		lineCount, path.c_str(), duration.count(),
+		positions.empty() ? (size_t)0 : (positionCount * sizeof(Position) + coefficientCount * sizeof(Coefficient)) / positionCount);
+
+	if (positions.empty())
+	{
+		return false;
+	}
+
+	// integer rounding in the engine's eval is all that should set the two apart
+	printf("Traced evals differ from the engine's by %f centipawns on average\n", traceError / positions.size());
+	return true;
+}
+
+void Tuner::LoadLines(std::ifstream& file, std::mutex& fileMutex, size_t& lineCount, std::vector<Position>& loaded,
+	std::vector<Coefficient>& loadedCoefficients, double& traceError) const
+{
+	EvalBoard* board = new EvalBoard();
+	board->InitHeadless();
+	EvalTrace* trace = new EvalTrace();
+
+	std::string line;
+	std::string placement;
+	bool bWhiteToMove;
+	float result;
+	while (true)
+	{
+		{
+			std::lock_guard<std::mutex> lock(fileMutex);
+			if (!std::getline(file, line))
+			{
+				break;
+			}
+			lineCount++;
+		}
+
+		if (!ParseLine(line, placement, bWhiteToMove, result))
+		{
+			continue;
+		}
+
+		// with a scale of 0 the eval is 0 whatever the weights, so the position has nothing to say about them
+		int eval = board->TracePosition(placement, bWhiteToMove ? PieceTeam::WHITE : PieceTeam::BLACK, *trace);
+		if (!trace->bLinear || trace->scale == 0)
+		{
+			continue;
+		}
+
+		Position position = { result, (uint8_t)trace->phase, (uint8_t)trace->scale, 0, (uint32_t)loadedCoefficients.size() };
+		for (size_t feature = 0; feature < features.size(); feature++)
+		{
+			int16_t count = trace->coefficients[features[feature].middlegame];
+			if (count != 0)
+			{
+				loadedCoefficients.push_back({ (uint16_t)feature, count });
+				position.coefficientCount++;
+			}
+		}
+
+		traceError += std::abs(Evaluate(position, loadedCoefficients.data()) - eval);
+		loaded.push_back(position);
+	}
+
+	delete trace;
+	delete board;
+}
+
+bool Tuner::ParseLine(const std::string& line, std::string& placement, bool& bWhiteToMove, float& result) const
+{
+	size_t placementEnd = line.find(' ');
+	if (placementEnd == std::string::npos || placementEnd + 1 >= line.size())
+	{
+		return false;
+	}
+
+	placement = line.substr(0, placementEnd);
+	if (std::count(placement.begin(), placement.end(), 'K') != 1 || std::count(placement.begin(), placement.end(), 'k') != 1)
+	{
+		return false;
+	}
+	bWhiteToMove = line[placementEnd + 1] != 'b';
+
+	// looked for only after the placement and side to move, which could otherwise be mistaken for a result
+	size_t rest = placementEnd + 2;
+	size_t bracket = line.find('[', rest);
+	if (line.find("1/2-1/2", rest) != std::string::npos)
+	{
+		result = 0.5f;
+	}
+	else if (line.find("1-0", rest) != std::string::npos)
+	{
+		result = 1.f;
+	}
+	else if (line.find("0-1", rest) != std::string::npos)
+	{
+		result = 0.f;
+	}
+	else if (bracket != std::string::npos)
+	{
+		result = std::strtof(line.c_str() + bracket + 1, nullptr);
+	}
+	else
+	{
+		return false;
+	}
+
+	return result >= 0.f && result <= 1.f;
+}
+
+double Tuner::Evaluate(const Position& position, const Coefficient* pool) const
+{
+	double middlegame = 0.0;
+	double endgame = 0.0;
+	const Coefficient* coefficient = pool + position.firstCoefficient;
+	for (int i = 0; i < position.coefficientCount; i++, coefficient++)
+	{
+		middlegame += coefficient->count * middlegameWeights[coefficient->feature];
+		endgame += coefficient->count * endgameWeights[coefficient->feature];
+	}
+
+	endgame *= (double)position.scale / MaterialTable::SCALE_NORMAL;
+	return (middlegame * position.phase + endgame * (PHASE_MAX - position.phase)) / PHASE_MAX;
+}
+
+double Tuner::Sigmoid(double eval) const
+{
+	return 1.0 / (1.0 + std::pow(10.0, -scalingConstant * eval / 400.0));
+}
+
+double Tuner::TotalError() const
+{
+	std::vector<double> errors(threadCount, 0.0);
+	ForEachThread(positions.size(), [&](size_t begin, size_t end, int thread)
+		{
+			double error = 0.0;
+			for (size_t i = begin; i < end; i++)
+			{
+				double difference = positions[i].result - Sigmoid(Evaluate(positions[i], coefficients.data()));
+				error += difference * difference;
+			}
+			errors[thread] = error;
+		});
+
+	double total = 0.0;
+	for (double error : errors)
+	{
+		total += error;
+	}
+	return total / positions.size();
+}
+
+void Tuner::CalcGradient(size_t begin, size_t end, std::vector<double>& gradient) const
+{
+	// middlegame weights then endgame weights, each position's share of the derivative of the squared error left
+	// without the factors every position has in common
+	size_t endgameOffset = features.size();
+	for (size_t i = begin; i < end; i++)
+	{
+		const Position& position = positions[i];
+		double sigmoid = Sigmoid(Evaluate(position, coefficients.data()));
+		double term = (sigmoid - position.result) * sigmoid * (1.0 - sigmoid);
+		double middlegameTerm = term * position.phase / PHASE_MAX;
+		double endgameTerm = term * (PHASE_MAX - position.phase) / PHASE_MAX * position.scale / MaterialTable::SCALE_NORMAL;
+
+		const Coefficient* coefficient = coefficients.data() + position.firstCoefficient;
+		for (int j = 0; j < position.coefficientCount; j++, coefficient++)
+		{
+			gradient[coefficient->feature] += middlegameTerm * coefficient->count;
+			gradient[endgameOffset + coefficient->feature] += endgameTerm * coefficient->count;
+		}
+	}
+}
+
+void Tuner::FitScalingConstant()
+{
+	// narrows in on the best K a decimal place at a time
+	double best = scalingConstant;
+	double bestError = TotalError();
+	for (double step = 1.0; step >= 0.001; step /= 10.0)
+	{
+		double centre = best;
+		for (int i = -10; i <= 10; i++)
+		{
+			scalingConstant = centre + i * step;
+			if (scalingConstant <= 0.0)
+			{
+				continue;
+			}
+
+			double error = TotalError();
+			if (error < bestError)
+			{
+				best = scalingConstant;
+				bestError = error;
+			}
+		}
+	}
+
+	scalingConstant = best;
+	printf("Scaling constant %f, starting error %f\n", scalingConstant, bestError);
+}
+
+void Tuner::Tune(int epochs)
+{
+	if (positions.empty())
+	{
+		return;
+	}
+
+	FitScalingConstant();
+
+	size_t weightCount = features.size() * 2;
+	std::vector<double> momentum(weightCount, 0.0);
+	std::vector<double> velocity(weightCount, 0.0);
+	std::vector<std::vector<double>> gradients(threadCount, std::vector<double>(weightCount));
+	std::vector<double> gradient(weightCount);
+	int step = 0;
+
+	for (int epoch = 1; epoch <= epochs; epoch++)
+	{
+		auto start = std::chrono::steady_clock::now();
+
+		for (size_t batch = 0; batch < positions.size(); batch += BATCH_SIZE)
+		{
+			size_t batchSize = std::min((size_t)BATCH_SIZE, positions.size() - batch);
+			ForEachThread(batchSize, [&](size_t begin, size_t end, int thread)
+				{
+					std::fill(gradients[thread].begin(), gradients[thread].end(), 0.0);
+					CalcGradient(batch + begin, batch + end, gradients[thread]);
+				});
+
+			// d(sigmoid)/d(eval) is K ln(10) / 400 times sigmoid (1 - sigmoid), and the squared error brings a 2
+			double factor = 2.0 * scalingConstant * std::log(10.0) / 400.0 / batchSize;
+			std::fill(gradient.begin(), gradient.end(), 0.0);
+			for (const std::vector<double>& threadGradient : gradients)
+			{
+				for (size_t i = 0; i < weightCount; i++)
+				{
+					gradient[i] += threadGradient[i] * factor;
+				}
+			}
+
+			step++;
+			double momentumCorrection = 1.0 - std::pow(ADAM_BETA1, step);
+			double velocityCorrection = 1.0 - std::pow(ADAM_BETA2, step);
+			for (size_t i = 0; i < weightCount; i++)
+			{
+				size_t feature = i % features.size();
+				if (i >= features.size() && features[feature].endgame < 0)
+				{
+					continue;
+				}
+
+				momentum[i] = ADAM_BETA1 * momentum[i] + (1.0 - ADAM_BETA1) * gradient[i];
+				velocity[i] = ADAM_BETA2 * velocity[i] + (1.0 - ADAM_BETA2) * gradient[i] * gradient[i];
+				double update = LEARNING_RATE * (momentum[i] / momentumCorrection) / (std::sqrt(velocity[i] / velocityCorrection) + ADAM_EPSILON);
+
+				std::vector<double>& weights = i < features.size() ? middlegameWeights : endgameWeights;
+				weights[feature] -= update;
+			}
+		}
+
+		std::chrono::duration<float> duration = std::chrono::steady_clock::now() - start;
+		printf("Epoch %d: error %f, %f seconds\n", epoch, TotalError(), duration.count());
+	}
+}
+
+EvalParameters Tuner::ToParameters() const
+{
+	EvalParameters params = defaultEvalParameters;
+	int32_t* values = reinterpret_cast<int32_t*>(&params);
+	for (size_t i = 0; i < features.size(); i++)
+	{
+		values[features[i].middlegame] = (int32_t)std::lround(middlegameWeights[i]);
+		if (features[i].endgame >= 0)
+		{
+			values[features[i].endgame] = (int32_t)std::lround(endgameWeights[i]);
+		}
+	}
+	return params;
+}
+
+bool Tuner::WriteParameters(const std::string& evalPath, const std::string& tablesPath) const
+{
+	EvalParameters params = ToParameters();
+	if (!WeightsFile::Write(evalPath, WeightsFile::Content::EVAL_PARAMETERS, { { EvalParameters::SECTION_ID, &params, sizeof(params) } }))
+	{
+		return false;
+	}
+
+	std::ofstream file(tablesPath, std::ios::trunc);
+	if (!file)
+	{
+		printf("Failed to create %s\n", tablesPath.c_str());
+		return false;
+	}
+
+	file << "static constexpr EvalParameters defaultEvalParameters =\n{\n";
+	file << "\t" << FormatList(params.phaseWeights, 8) << ",\n";
+	file << "\t" << FormatList(params.middlegameValues, 8) << ",\n";
+	file << "\t" << FormatList(params.endgameValues, 8) << ",\n";
+	for (const auto& tables : { &params.middlegameTables, &params.endgameTables })
+	{
+		file << "\t{\n";
+		for (int type = KING; type <= PAWN; type++)
+		{
+			file << "\t\t// " << TABLE_NAMES[type] << "\n\t\t{\n";
+			WriteRows(file, (*tables)[type], 64, "\t\t\t");
+			file << "\t\t}" << (type < PAWN ? "," : "") << "\n";
+		}
+		file << "\t},\n";
+	}
+	file << "\t" << FormatList(params.doubledPawn, 2) << ",\n";
+	file << "\t" << FormatList(params.isolatedPawn, 2) << ",\n";
+	file << "\t" << FormatList(params.backwardPawn, 2) << ",\n";
+	file << "\t{\n\t\t" << FormatList(params.passedPawn[0], 8) << ",\n\t\t" << FormatList(params.passedPawn[1], 8) << "\n\t},\n";
+	file << "\t" << FormatList(params.pawnShield, 2) << ",\n";
+	file << "\t" << FormatList(params.bishopPair, 2) << ",\n";
+	file << "\t" << FormatList(params.knightPawns, 2) << ",\n";
+	file << "\t" << FormatList(params.rookPawns, 2) << ",\n";
+	file << "\t{ ";
+	for (int type = KING; type <= PAWN; type++)
+	{
+		file << FormatList(params.mobility[type], 2) << (type < PAWN ? ", " : " ");
+	}
+	file << "},\n";
+	file << "\t" << FormatList(params.mobilityBaseline, 6) << ",\n";
+	file << "\t" << FormatList(params.kingAttackWeights, 6) << ",\n";
+	file << "\t{\n";
+	WriteRows(file, params.kingDanger, 64, "\t\t");
+	file << "\t}\n};\n";
+
+	printf("Wrote tuned parameters to %s and %s\n", evalPath.c_str(), tablesPath.c_str());
+	return (bool)file;
+}
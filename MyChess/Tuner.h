@@ -0,0 +1,95 @@
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "EvalTables.h"
+
+class SearchWorker;
+
+// Texel tuning of the table evaluation against game results. Each quiet position of a dataset is traced once on load,
+// which leaves how many times it uses each parameter, so from then on scoring it under any parameters is a short dot
+// product rather than a full evaluation. The mean squared error between the results and the evals mapped through a
+// sigmoid is minimised with Adam over mini-batches, the gradient of each batch split across every core.
+//
+// Positions are one line each: a FEN, then the result either as "1-0", "0-1" or "1/2-1/2" or as white's score in
+// brackets, such as [0.5]. Positions scored by a specialised endgame function aren't linear in the parameters and
+// are skipped, as are ones whose material can't win for either side, which the eval calls a draw whatever the weights.
+class Tuner
+{
+public:
+	Tuner();
+	~Tuner();
+
+	Tuner(const Tuner&) = delete;
+	Tuner& operator= (const Tuner&) = delete;
+
+	bool LoadPositions(const std::string& path);
+	void Tune(int epochs);
+
+	// writes the tuned parameters as a WeightsFile for LoadEvalParameters and as a constexpr EvalParameters to paste
+	// over the defaults in EvalTables.h
+	bool WriteParameters(const std::string& evalPath, const std::string& tablesPath) const;
+
+private:
+	static const int BATCH_SIZE = 16384;
+
+	// a middlegame parameter and the endgame one always used the same number of times, or -1 for middlegame only.
+	// Both are indices into EvalParameters as an array of int32_t
+	struct Feature
+	{
+		int middlegame;
+		int endgame;
+	};
+
+	struct Coefficient
+	{
+		uint16_t feature;
+		int16_t count;
+	};
+
+	// the coefficients of a position are coefficientCount in a row from firstCoefficient in the shared pool, which keeps
+	// a position to 12 bytes and its few dozen coefficients to 4 bytes each
+	struct Position
+	{
+		float result; // white's score, 1 for a win
+		uint8_t phase;
+		uint8_t scale;
+		uint16_t coefficientCount;
+		uint32_t firstCoefficient;
+	};
+
+	void PrepFeatures();
+	// takes lines from the file until it runs out, so every thread reads and traces the next line as soon as it's free
+	void LoadLines(std::ifstream& file, std::mutex& fileMutex, size_t& lineCount, std::vector<Position>& loaded,
+		std::vector<Coefficient>& loadedCoefficients, double& traceError) const;
+	bool ParseLine(const std::string& line, std::string& placement, bool& bWhiteToMove, float& result) const;
+
+	double Evaluate(const Position& position, const Coefficient* pool) const;
+	double Sigmoid(double eval) const;
+	double TotalError() const;
+	void CalcGradient(size_t begin, size_t end, std::vector<double>& gradient) const;
+	void FitScalingConstant();
+
+	// runs job(begin, end, thread) over count items split evenly across the workers, and waits for them all
+	void ForEachThread(size_t count, const std::function<void(size_t, size_t, int)>& job) const;
+
+	EvalParameters ToParameters() const;
+
+	std::vector<Feature> features;
+	std::vector<double> middlegameWeights;
+	std::vector<double> endgameWeights;
+
+	std::vector<Position> positions;
+	std::vector<Coefficient> coefficients;
+
+	double scalingConstant; // K of the sigmoid, fitted to the starting parameters so their evals match the results
+	int threadCount;
+
+	// made once and reused by every pass over the positions, which happens a few times per batch
+	std::vector<SearchWorker*> workers;
+};
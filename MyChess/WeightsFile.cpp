@@ -0,0 +1,181 @@
+#include "WeightsFile.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+WeightsFile::WeightsFile()
+{
+	data = nullptr;
+	size = 0;
+	sections = nullptr;
+	sectionCount = 0;
+#ifdef _WIN32
+	fileHandle = nullptr;
+	mappingHandle = nullptr;
+#endif
+}
+
+WeightsFile::~WeightsFile()
+{
+	Close();
+}
+
+bool WeightsFile::Open(const std::string& path, Content content)
+{
+	Close();
+
+#ifdef _WIN32
+	HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+	{
+		printf("Failed to open weights file %s\n", path.c_str());
+		return false;
+	}
+	fileHandle = file;
+
+	LARGE_INTEGER fileSize;
+	HANDLE mapping = GetFileSizeEx(file, &fileSize) && fileSize.QuadPart > 0 ? CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr) : nullptr;
+	if (mapping == nullptr)
+	{
+		printf("Failed to map weights file %s\n", path.c_str());
+		Close();
+		return false;
+	}
+	mappingHandle = mapping;
+
+	data = static_cast<const uint8_t*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+	size = (size_t)fileSize.QuadPart;
+#else
+	int file = open(path.c_str(), O_RDONLY);
+	if (file < 0)
+	{
+		printf("Failed to open weights file %s\n", path.c_str());
+		return false;
+	}
+
+	// the mapping stays valid after the descriptor is closed
+	struct stat fileStat;
+	void* mapped = fstat(file, &fileStat) == 0 && fileStat.st_size > 0 ? mmap(nullptr, (size_t)fileStat.st_size, PROT_READ, MAP_SHARED, file, 0) : MAP_FAILED;
+	close(file);
+
+	data = mapped == MAP_FAILED ? nullptr : static_cast<const uint8_t*>(mapped);
+	size = mapped == MAP_FAILED ? 0 : (size_t)fileStat.st_size;
+#endif
+
+	if (data == nullptr)
+	{
+		printf("Failed to map weights file %s\n", path.c_str());
+		Close();
+		return false;
+	}
+
+	const Header* header = reinterpret_cast<const Header*>(data);
+	if (size < sizeof(Header) || std::memcmp(header->magic, "MCWF", 4) != 0 || header->version != VERSION || header->content != content ||
+		size < sizeof(Header) + (size_t)header->sectionCount * sizeof(Section))
+	{
+		printf("Weights file %s is not a version %u file of the expected content\n", path.c_str(), VERSION);
+		Close();
+		return false;
+	}
+
+	sections = reinterpret_cast<const Section*>(data + sizeof(Header));
+	sectionCount = header->sectionCount;
+	for (uint32_t i = 0; i < sectionCount; i++)
+	{
+		if (sections[i].offset % ALIGNMENT != 0 || sections[i].offset > size || sections[i].size > size - sections[i].offset)
+		{
+			printf("Weights file %s has a misaligned or truncated section\n", path.c_str());
+			Close();
+			return false;
+		}
+	}
+
+	return true;
+}
+
+void WeightsFile::Close()
+{
+#ifdef _WIN32
+	if (data != nullptr)
+	{
+		UnmapViewOfFile(data);
+	}
+	if (mappingHandle != nullptr)
+	{
+		CloseHandle(mappingHandle);
+	}
+	if (fileHandle != nullptr)
+	{
+		CloseHandle(fileHandle);
+	}
+	fileHandle = nullptr;
+	mappingHandle = nullptr;
+#else
+	if (data != nullptr)
+	{
+		munmap(const_cast<uint8_t*>(data), size);
+	}
+#endif
+
+	data = nullptr;
+	size = 0;
+	sections = nullptr;
+	sectionCount = 0;
+}
+
+const void* WeightsFile::FindSection(uint32_t id, size_t bytes) const
+{
+	for (uint32_t i = 0; i < sectionCount; i++)
+	{
+		if (sections[i].id == id)
+		{
+			return sections[i].size == bytes ? data + sections[i].offset : nullptr;
+		}
+	}
+
+	return nullptr;
+}
+
+bool WeightsFile::Write(const std::string& path, Content content, const std::vector<SectionData>& sectionData)
+{
+	std::ofstream file(path, std::ios::binary | std::ios::trunc);
+	if (!file)
+	{
+		printf("Failed to create weights file %s\n", path.c_str());
+		return false;
+	}
+
+	Header header = { { 'M', 'C', 'W', 'F' }, VERSION, content, (uint32_t)sectionData.size() };
+	file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+	uint64_t offset = sizeof(Header) + sectionData.size() * sizeof(Section);
+	for (const SectionData& section : sectionData)
+	{
+		offset = (offset + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+		Section entry = { section.id, 0, offset, section.size };
+		file.write(reinterpret_cast<const char*>(&entry), sizeof(entry));
+		offset += section.size;
+	}
+
+	for (const SectionData& section : sectionData)
+	{
+		static const char padding[ALIGNMENT] = {};
+		size_t position = (size_t)file.tellp();
+		file.write(padding, (ALIGNMENT - position % ALIGNMENT) % ALIGNMENT);
+		file.write(static_cast<const char*>(section.data), section.size);
+	}
+
+	return (bool)file;
+}
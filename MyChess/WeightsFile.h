@@ -0,0 +1,82 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// Read-only memory map of a versioned binary file of evaluation weights. Weights are used in place from the mapping
+// rather than copied onto the heap, so loading costs no more than opening the file, and every engine process on the
+// machine shares the one copy in the page cache.
+//
+// Layout, all little endian: a Header, then sectionCount Sections, then the data of each section at an offset that
+// is a multiple of ALIGNMENT from the start of the file. The mapping starts on a page boundary, so section data is
+// always aligned for SIMD loads.
+class WeightsFile
+{
+public:
+	WeightsFile();
+	~WeightsFile();
+
+	WeightsFile(const WeightsFile&) = delete;
+	WeightsFile& operator= (const WeightsFile&) = delete;
+
+	static const uint32_t VERSION = 1;
+	static const size_t ALIGNMENT = 64;
+
+	enum class Content : uint32_t
+	{
+		EVAL_PARAMETERS = 1,
+		NNUE = 2
+	};
+
+	struct Header
+	{
+		char magic[4]; // "MCWF"
+		uint32_t version;
+		Content content;
+		uint32_t sectionCount;
+	};
+
+	struct Section
+	{
+		uint32_t id;
+		uint32_t reserved;
+		uint64_t offset;
+		uint64_t size;
+	};
+
+	// maps the file and checks its header and that every section lies inside it, aligned
+	bool Open(const std::string& path, Content content);
+	void Close();
+
+	// the section with the given id if it holds exactly count values of T, otherwise nullptr
+	template <typename T>
+	const T* GetSection(uint32_t id, size_t count) const
+	{
+		return static_cast<const T*>(FindSection(id, count * sizeof(T)));
+	}
+
+	struct SectionData
+	{
+		uint32_t id;
+		const void* data;
+		size_t size;
+	};
+
+	// writes sections in the layout Open() expects, for tools producing weights
+	static bool Write(const std::string& path, Content content, const std::vector<SectionData>& sections);
+
+private:
+	const uint8_t* data;
+	size_t size;
+	const Section* sections;
+	uint32_t sectionCount;
+
+#ifdef _WIN32
+	void* fileHandle;
+	void* mappingHandle;
+#endif
+
+	const void* FindSection(uint32_t id, size_t bytes) const;
+};
@@ -16,6 +16,7 @@
 #include "Window.h"
 #include "Shader.h"
 #include "PickingTexture.h"
+#include "Tuner.h"
 
 const int WIDTH = 1366; const int HEIGHT = 768;
 
@@ -77,8 +78,28 @@ void HandleBoardClick(int& clickedObjectId)
 	}
 }
 
-int main()
+// MyChess --tune <dataset> [epochs] tunes the table eval against the dataset's results without opening a window
+int Tune(int argc, char** argv)
 {
+	int epochs = argc > 3 ? std::atoi(argv[3]) : 10;
+
+	Tuner tuner;
+	if (!tuner.LoadPositions(argv[2]))
+	{
+		return 1;
+	}
+
+	tuner.Tune(epochs);
+	return tuner.WriteParameters("networks/eval.bin", "networks/EvalTables.tuned.h") ? 0 : 1;
+}
+
+int main(int argc, char** argv)
+{
+	if (argc > 2 && std::string(argv[1]) == "--tune")
+	{
+		return Tune(argc, argv);
+	}
+
 	window.Initialise(WIDTH, HEIGHT, false);
 
 	glEnable(GL_BLEND);